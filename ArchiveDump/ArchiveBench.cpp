@@ -0,0 +1,401 @@
+// Benchmarks over generated archives: open, index walk, per codec decode, GetFile, CR2W table
+// walks and a full extraction. Builds on the same sources as ArchiveDump:
+//   g++ -std=c++20 -O2 -o ArchiveBench ArchiveDump/ArchiveBench.cpp ArchiveDump/ArchiveExtract.cpp -llz4 -lz -lpthread -ldl
+#include "RADR.hpp"
+#include "ArchiveExtract.hpp"
+#include "CR2W.hpp"
+#include "MappedArchiveFile.hpp"
+#include "RedArchiveReader.hpp"
+#include "SyntheticArchive.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------
+// stdout is pointed at the null device while extraction runs, its per entry log would
+// otherwise dominate the measurement
+class QuietStdout {
+public:
+    QuietStdout()
+    {
+        fflush(stdout);
+#ifdef _WIN32
+        saved = _dup(_fileno(stdout));
+        FILE* null = fopen("NUL", "w");
+        if (null)
+        {
+            _dup2(_fileno(null), _fileno(stdout));
+            fclose(null);
+        }
+#else
+        saved = dup(fileno(stdout));
+        FILE* null = fopen("/dev/null", "w");
+        if (null)
+        {
+            dup2(fileno(null), fileno(stdout));
+            fclose(null);
+        }
+#endif
+    }
+    ~QuietStdout()
+    {
+        fflush(stdout);
+        if (saved < 0)
+            return;
+#ifdef _WIN32
+        _dup2(saved, _fileno(stdout));
+        _close(saved);
+#else
+        dup2(saved, fileno(stdout));
+        close(saved);
+#endif
+    }
+private:
+    int saved = -1;
+};
+
+struct BenchResult {
+    string name;
+    double median_ms;
+    double min_ms;
+    uint64_t bytes;     // processed per iteration, 0 if throughput means nothing
+};
+
+struct BenchOptions {
+    uint32_t iterations = 5;
+    uint32_t threads = 0;
+    vector<string> filters;
+    SyntheticArchiveOptions archive;
+};
+
+// median and min wall time of fn over the iterations, after one warm-up run
+static BenchResult measure(const char* name, const BenchOptions& opt, uint64_t bytes, const function<void()>& fn)
+{
+    fn();
+    vector<double> ms;
+    for (uint32_t k = 0; k < opt.iterations; k++)
+    {
+        auto start = chrono::steady_clock::now();
+        fn();
+        ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    sort(ms.begin(), ms.end());
+    BenchResult r{ name, ms[ms.size() / 2], ms[0], bytes };
+    if (r.bytes)
+        printf("%-18s %10.3f ms  (min %10.3f)  %9.1f MiB/s\n", name, r.median_ms, r.min_ms, double(bytes) / 1048576.0 / (r.median_ms / 1000.0));
+    else
+        printf("%-18s %10.3f ms  (min %10.3f)\n", name, r.median_ms, r.min_ms);
+    return r;
+}
+
+static bool wanted(const BenchOptions& opt, const char* name)
+{
+    if (opt.filters.empty())
+        return true;
+    for (auto& f : opt.filters)
+        if (strstr(name, f.c_str()))
+            return true;
+    return false;
+}
+
+static uint64_t total_decompressed(RedArchive& archive)
+{
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
+        bytes += archive.GetDecompressedSize(i);
+    return bytes;
+}
+
+static vector<BenchResult> run_benchmarks(const filesystem::path& dir, const BenchOptions& opt)
+{
+    vector<BenchResult> results;
+
+    // one mixed archive plus one per codec, so codec numbers are not blurred by the mix
+    struct Generated { const char* name; filesystem::path path; SyntheticArchiveOptions options; };
+    vector<Generated> archives = { { "mixed", dir / "mixed.archive", opt.archive } };
+    const struct { const char* name; uint32_t stored, lz4, zlib; } codecs[] = { { "stored", 1, 0, 0 }, { "xlz4", 0, 1, 0 }, { "zlib", 0, 0, 1 } };
+    for (auto& c : codecs)
+    {
+        auto o = opt.archive;
+        o.storedWeight = c.stored;
+        o.lz4Weight = c.lz4;
+        o.zlibWeight = c.zlib;
+        o.cr2wShare = 0;
+        archives.push_back({ c.name, dir / (string(c.name) + ".archive"), o });
+    }
+    for (auto& a : archives)
+    {
+        auto start = chrono::steady_clock::now();
+        if (!SyntheticArchive::Write(a.path, a.options))
+        {
+            printf("Cannot write %s\n", a.path.string().c_str());
+            return results;
+        }
+        printf("[Bench] generated %s: %.1f MiB in %.2fs\n", a.path.filename().string().c_str(),
+            double(filesystem::file_size(a.path)) / 1048576.0, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+
+    MappedArchiveFile mixed_file;
+    if (!mixed_file.Open(archives[0].path))
+        return results;
+    RedArchive mixed(mixed_file.Data());
+    const uint32_t count = mixed.fileTable->fileEntryCount;
+    const uint64_t mixed_bytes = total_decompressed(mixed);
+
+    if (wanted(opt, "open"))
+    {
+        results.push_back(measure("open", opt, 0, [&] {
+            MappedArchiveFile f;
+            f.Open(archives[0].path);
+            RedArchive archive(f.Data());
+        }));
+    }
+
+    if (wanted(opt, "index-walk"))
+    {
+        vector<uint64_t> ids(count);
+        vector<uint32_t> found(count);
+        for (uint32_t i = 0; i < count; i++)
+            ids[i] = mixed.entry[i].id;
+        results.push_back(measure("index-walk", opt, 0, [&] {
+            mixed.FindFiles(ids, found);
+            volatile uint64_t sink = total_decompressed(mixed);
+            (void)sink;
+        }));
+    }
+
+    vector<unsigned char> out;
+    for (size_t a = 1; a < archives.size(); a++)
+    {
+        string name = string("decode-") + archives[a].name;
+        if (!wanted(opt, name.c_str()))
+            continue;
+        MappedArchiveFile f;
+        if (!f.Open(archives[a].path))
+            continue;
+        RedArchive archive(f.Data());
+        results.push_back(measure(name.c_str(), opt, total_decompressed(archive), [&] {
+            for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
+            {
+                out.resize(archive.GetDecompressedSize(i));
+                archive.DecompressFile(i, out);
+            }
+        }));
+    }
+
+    if (wanted(opt, "getfile"))
+    {
+        results.push_back(measure("getfile", opt, mixed_bytes, [&] {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                volatile size_t sink = mixed.GetFile(i).data.size();
+                (void)sink;
+            }
+        }));
+    }
+
+    // every entry cached by the first pass, the timed passes are hash probes
+    if (wanted(opt, "reader-cached"))
+    {
+        RedArchiveReader reader;
+        RedArchiveReader::Options reader_opt;
+        reader_opt.cacheBytes = mixed_bytes * 2 + (64ull << 20);
+        if (reader.Open(archives[0].path, reader_opt))
+        {
+            results.push_back(measure("reader-cached", opt, mixed_bytes, [&] {
+                for (uint32_t i = 0; i < reader.EntryCount(); i++)
+                {
+                    volatile size_t sink = reader.GetFile(i)->data.size();
+                    (void)sink;
+                }
+            }));
+        }
+    }
+
+    // CR2W entries decoded once up front, only the table work is timed
+    vector<vector<unsigned char>> cr2w_files;
+    uint64_t cr2w_bytes = 0;
+    for (uint32_t i = 0; i < count && (wanted(opt, "cr2w-view") || wanted(opt, "cr2w-validate")); i++)
+    {
+        auto f = mixed.GetFile(i);
+        if (f.data.size() >= sizeof(CR2W) && *f.Get<uint32_t>() == 'W2RC')
+        {
+            cr2w_bytes += f.data.size();
+            cr2w_files.push_back(move(f.data));
+        }
+    }
+    if (!cr2w_files.empty() && wanted(opt, "cr2w-view"))
+    {
+        results.push_back(measure("cr2w-view", opt, 0, [&] {
+            size_t sink = 0;
+            for (auto& data : cr2w_files)
+            {
+                CR2WView view(reinterpret_cast<CR2W*>(data.data()));
+                for (auto&& imp : view.Imports())
+                    sink += strlen(view.DepotPath(imp));
+                auto exports = view.Exports();
+                for (auto&& ex : exports)
+                    for (auto child : view.Children(ex))
+                        sink += exports[child].dataSize;
+            }
+            volatile size_t keep = sink;
+            (void)keep;
+        }));
+    }
+    if (!cr2w_files.empty() && wanted(opt, "cr2w-validate"))
+    {
+        results.push_back(measure("cr2w-validate", opt, cr2w_bytes, [&] {
+            for (auto& data : cr2w_files)
+                reinterpret_cast<CR2W*>(data.data())->Validate(data.size());
+        }));
+    }
+
+    if (wanted(opt, "extract"))
+    {
+        auto dump = dir / "extract";
+        ExtractOptions ex;
+        ex.threads = opt.threads;
+        ex.memory_budget = 2048ull << 20;
+        results.push_back(measure("extract", opt, mixed_bytes, [&] {
+            filesystem::remove_all(dump);
+            vector<DumpJob> jobs;
+            jobs.push_back({ archives[0].path, dump });
+            QuietStdout quiet;
+            extract_radr_archives(jobs, ex);
+        }));
+        filesystem::remove_all(dump);
+    }
+
+    // a budget smaller than one verify group, every group has to be admitted on its own
+    if (wanted(opt, "verify-budget"))
+    {
+        ExtractOptions ex;
+        ex.threads = opt.threads;
+        ex.memory_budget = 1ull << 20;
+        ex.verify = true;
+        results.push_back(measure("verify-budget", opt, mixed_bytes, [&] {
+            vector<DumpJob> jobs;
+            jobs.push_back({ archives[0].path, dir / "verify" });
+            QuietStdout quiet;
+            extract_radr_archives(jobs, ex);
+        }));
+    }
+    return results;
+}
+
+// baseline files hold "name median_ms" per line
+static bool save_results(const filesystem::path& file, const vector<BenchResult>& results)
+{
+    ofstream ofs(file, ios::binary | ios::trunc);
+    for (auto& r : results)
+        ofs << r.name << ' ' << r.median_ms << '\n';
+    return bool(ofs);
+}
+
+// false if any benchmark got slower than the baseline by more than tolerance percent
+static bool compare_results(const filesystem::path& file, const vector<BenchResult>& results, double tolerance)
+{
+    ifstream ifs(file, ios::binary);
+    map<string, double> baseline;
+    string name;
+    double ms;
+    while (ifs >> name >> ms)
+        baseline[name] = ms;
+    bool ok = true;
+    for (auto& r : results)
+    {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0)
+            continue;
+        double change = (r.median_ms / it->second - 1.0) * 100.0;
+        bool regressed = change > tolerance;
+        printf("[Compare] %-18s %10.3f -> %10.3f ms  %+6.1f%%%s\n", r.name.c_str(), it->second, r.median_ms, change, regressed ? "  REGRESSION" : "");
+        ok = ok && !regressed;
+    }
+    return ok;
+}
+
+int main(int argc, const char** argv)
+{
+    OodleHelper::Initialize();
+
+    BenchOptions opt;
+    filesystem::path dir = filesystem::temp_directory_path() / "ArchiveBench";
+    const char* save_path = nullptr;
+    const char* compare_path = nullptr;
+    double tolerance = 10.0;
+    bool keep = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc)
+            opt.archive.entries = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+            opt.archive.maxSize = strtoull(argv[++i], nullptr, 10) << 10;
+        else if (strcmp(argv[i], "--cr2w") == 0 && i + 1 < argc)
+            opt.archive.cr2wShare = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            opt.archive.seed = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            opt.iterations = max(1u, uint32_t(strtoul(argv[++i], nullptr, 10)));
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            opt.threads = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0)
+            keep = true;
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            save_path = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            compare_path = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (argv[i][0] != '-')
+            opt.filters.push_back(argv[i]);
+        else
+        {
+            printf("Usage:\n"
+                "    %s [--entries N] [--max-size KB] [--cr2w SHARE] [--seed N] [-n N] [-j N] [--dir DIR] [--keep] [--save FILE] [--compare FILE [--tolerance PCT]] [NAME]...\n\n"
+                "    * NAME runs only benchmarks whose name contains it: open, index-walk, decode-stored, decode-xlz4, decode-zlib,\n"
+                "      getfile, reader-cached, cr2w-view, cr2w-validate, extract, verify-budget\n"
+                "    * --entries N, --max-size KB, --cr2w SHARE, --seed N shape the generated archives, default 1000, 256, 0.25, 1\n"
+                "    * -n N timed iterations per benchmark after one warm-up, the median is reported, default 5\n"
+                "    * -j N extraction threads, 0 for one per core\n"
+                "    * --dir DIR puts the generated archives in DIR instead of the temp directory, --keep leaves them there\n"
+                "    * --save FILE writes the medians, --compare FILE fails when one is more than PCT percent (default 10) slower\n",
+                filesystem::path(argv[0]).filename().string().c_str());
+            return 1;
+        }
+    }
+    if (opt.threads == 0)
+        opt.threads = max(1u, thread::hardware_concurrency());
+
+    filesystem::create_directories(dir);
+    auto results = run_benchmarks(dir, opt);
+    if (!keep)
+    {
+        error_code ec;
+        filesystem::remove_all(dir, ec);
+    }
+    if (results.empty())
+        return 1;
+    if (save_path && !save_results(save_path, results))
+        printf("Cannot write %s\n", save_path);
+    if (compare_path && !compare_results(compare_path, results, tolerance))
+        return 2;
+    return 0;
+}
@@ -1,213 +1,756 @@
-#include "RADR.hpp"
-#include "CR2W.hpp"
-
-#include <stdio.h>
-#include <filesystem>
-#include <assert.h>
-#include <string.h>
-#include <string>
-#include <map>
-#include <vector>
-#include <fstream>
-
-
-#include <Windows.h>
-
-using namespace std;
-
-struct DumpFlags {
-    bool name;
-    bool impt;
-    bool prop;
-    bool expt;
-    bool buffer;
-    bool embeded;
-};
-
-int extract_radr_archive(filesystem::path filepath, filesystem::path dump_path)
-{
-        const wstring map_name = L"RDAR_" + wstring(filepath.stem().c_str());
-
-        const auto filesize = filesystem::file_size(filepath);
-        const auto low_filesize = uint32_t(filesize & UINT32_MAX);
-        const auto high_filesize = uint32_t((filesize >> 32) & UINT32_MAX);
-
-        auto file_handle = CreateFile(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
-        if (file_handle == INVALID_HANDLE_VALUE)
-        {
-            printf("Could not open file: %d\n", GetLastError());
-            return 1;
-        }
-        auto hMapFile = CreateFileMapping(file_handle, NULL, PAGE_READONLY, high_filesize, low_filesize, map_name.c_str());
-        if (hMapFile == NULL)
-        {
-            printf("Could not create file mapping object: %d\n", GetLastError());
-            CloseHandle(file_handle);
-            return 1;
-        }
-        auto file_content = MapViewOfFile(hMapFile, FILE_MAP_READ, 0, 0, filesize);
-        if (file_content == NULL)
-        {
-            printf("Could not map view of file: %d\n", GetLastError());
-            CloseHandle(hMapFile);
-            CloseHandle(file_handle);
-            return 1;
-        }
-        
-        DumpFlags flag{
-            .buffer = true,
-        };
-        
-        
-        filesystem::create_directories(dump_path);
-        
-        RedArchive archive(file_content);
-        printf("========== RADR Archive: %S ==========\n", filepath.stem().c_str());
-        for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
-        {
-            RedArchiveFile f = archive.GetFile(i);
-
-            {
-                auto savepath = dump_path / filesystem::path(to_string(f.entry.id));
-                ofstream of(savepath.string());
-                of.write(reinterpret_cast<const char*>(f.data.data()), f.data.size());
-            }
-            
-            printf("--------- Extract %s : %llu ---------\n", (f.compressed ? "compressed  " : "uncompressed"), f.entry.id);
-
-            if (!f.compressed)
-                continue;
-
-            uint32_t magic = *reinterpret_cast<uint32_t*>(f.data.data());
-            if (magic == 'W2RC') // CR2W
-            {
-                // unpack CR2W files
-                auto cr2w = f.Get<CR2W>();
-                #define ENT_OFFSET  ( reinterpret_cast<uintptr_t>(&ent) - reinterpret_cast<uintptr_t>(cr2w))
-
-                if (flag.name)
-                {
-                    for (auto&& ent : cr2w->entries<CR2WName>())
-                    {
-                        printf("[Name] %p %s, %x\n", ENT_OFFSET, ent.GetName(cr2w), ent.hash);
-                    }
-                }
-                if (flag.impt)
-                {
-                    for (auto&& ent : cr2w->entries<CR2WImport>())
-                    {
-                        if (!ent.flags)
-                            continue;
-                        printf("[Import] %p className: %s, depotPath: %s, flags: %x\n",
-                            ENT_OFFSET,
-                            ent.GetTypeName(cr2w),
-                            ent.GetDepotPath(cr2w),
-                            ent.flags);
-                    }
-                }
-
-                if (flag.prop)
-                {
-                    for (auto&& ent : cr2w->entries<CR2WProperty>())
-                    {
-                        printf("[Property] %p className: %s, propertyName: %s\n", ENT_OFFSET, ent.GetTypeName(cr2w), ent.GetPropertyName(cr2w));
-                    }
-                }
-
-                if (flag.expt)
-                {
-                    for (auto&& ent : cr2w->entries<CR2WExport>())
-                    {
-                        printf("[Export]: %p %s\n", ENT_OFFSET, ent.GetName(cr2w).c_str());
-                        auto parent = ent.GetParent(cr2w);
-                        if (parent)
-                            printf("    [Parent]: %s\n", parent->GetName(cr2w).c_str());
-                        for (auto&& child : ent.GetChildren(cr2w))
-                        {
-                            printf("    [Child]: %s\n", child->GetName(cr2w).c_str());
-                        }
-                    }
-                }
-
-                if (flag.buffer)
-                {
-                    for (auto&& ent : cr2w->entries<CR2WBuffer>())
-                    {
-                        printf("[Buffer]: %p  index: %d, crc: %x, size: %d/%d\n", ENT_OFFSET, ent.index, ent.crc32, ent.diskSize, ent.memSize);
-                        auto buf_savepath = dump_path / filesystem::path(to_string(f.entry.id) +  "_buf_" + to_string(ent.index));
-                        filesystem::create_directories(buf_savepath.parent_path());
-                        ofstream bof(buf_savepath.string());
-                        bof.write(cr2w->Get<const char>(ent.offset), ent.diskSize);
-                    }
-                }
-
-                // BROKEN
-                if (flag.embeded)
-                {
-                    for (auto&& ent : cr2w->entries<CR2WEmbedded>())
-                    {
-                        const char* x = "";
-                        auto imp = ent.GetImport(cr2w);
-                        if (imp)
-                            x = imp->GetDepotPath(cr2w);
-                        printf("[Embedded]: %p  size: %d, path:%s, importDepotPath:%s\n", ENT_OFFSET, ent.dataSize, ent.GetPath(cr2w), x);
-                    }
-                }
-            }
-            else {
-                assert(0);
-            }
-
-        }
-
-        UnmapViewOfFile(file_content);
-        CloseHandle(hMapFile);
-        CloseHandle(file_handle);
-        return 0;
-}
-
-int main(int argc, const char** argv)
-{
-    OodleHelper::Initialize();
-
-    if (argc <= 1) {
-        printf("Usage:\n"
-                "    %S InputFileOrDir [OutputDir]\n\n"
-                "    * default value of OutputDir is filename\n", filesystem::path(argv[0]).filename().c_str());
-        return 1;
-    }
-
-    filesystem::path filepath = argv[1];
-    if (!filesystem::exists(filepath))
-    {
-        printf("File dor dir not exists\n");
-        return 1;
-    }
-
-    if (filesystem::is_regular_file(filepath))
-    {
-        filesystem::path default_dump_path = filepath.stem();
-        filesystem::path dump_path;
-        if (argc >= 3)
-            dump_path = argv[2];
-        else
-            dump_path = default_dump_path;
-        return extract_radr_archive(filepath, dump_path);
-    }
-
-    for (const auto& fp : filesystem::directory_iterator(filepath))
-    {
-        filesystem::path default_dump_path = "dump";
-        filesystem::path dump_path;
-        if (argc >= 3)
-            dump_path = argv[2];
-        else
-            dump_path = default_dump_path;
-        const filesystem::path& fpath = fp.path();
-        filesystem::path dpath = dump_path / filepath.stem();
-        if (fpath.extension() != ".archive")
-            continue;
-        extract_radr_archive(fpath, dpath);
-    }
-    return 0;
-}
+#include "RADR.hpp"
+#include "ArchiveExtract.hpp"
+#include "CR2W.hpp"
+#include "CR2WIndex.hpp"
+#include "GlobalIndex.hpp"
+#include "Manifest.hpp"
+#include "MappedArchiveFile.hpp"
+#include "PathDictionary.hpp"
+#include "RedArchiveWriter.hpp"
+#include "Telemetry.hpp"
+#include "ThreadPool.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <filesystem>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <chrono>
+
+
+using namespace std;
+
+// Bring the index of a directory up to date. Archives whose size and file table crc64 match
+// the previous index are copied over without touching their entry tables.
+static bool update_global_index(const filesystem::path& dir, const filesystem::path& index_path, GlobalIndex& index)
+{
+    GlobalIndex previous;
+    previous.Open(index_path);
+
+    vector<filesystem::path> paths;
+    for (const auto& fp : filesystem::directory_iterator(dir))
+        if (fp.path().extension() == ".archive")
+            paths.push_back(fp.path());
+    sort(paths.begin(), paths.end());
+
+    GlobalIndexBuilder builder;
+    uint32_t reused = 0;
+    uint32_t rescanned = 0;
+    for (auto&& path : paths)
+    {
+        MappedArchiveFile file;
+        MappedArchiveFile::Options map_opt;
+        map_opt.sequential = false;
+        uint64_t crc64 = 0;
+        if (!file.Open(path, map_opt) || !GetArchiveStamp(file.Data(), file.Size(), crc64))
+        {
+            printf("Not a RADR archive: %s\n", path.string().c_str());
+            continue;
+        }
+        string name = path.filename().string();
+        uint32_t old = previous.FindArchive(name);
+        if (old != UINT32_MAX && previous.Archive(old).fileSize == file.Size() && previous.Archive(old).crc64 == crc64)
+        {
+            builder.CopyArchive(previous, old);
+            reused++;
+            continue;
+        }
+        if (!ArchiveTablesInBounds(file.Data(), file.Size()))
+        {
+            printf("Not a RADR archive: %s\n", path.string().c_str());
+            continue;
+        }
+        RedArchive archive(file.Data());
+        builder.AddArchive(name, file.Size(), archive);
+        rescanned++;
+    }
+
+    // nothing changed, keep the old file
+    if (rescanned == 0 && previous.IsOpen() && reused == previous.ArchiveCount())
+    {
+        printf("[Index] %s: %u archives, %u entries, up to date\n", index_path.string().c_str(), previous.ArchiveCount(), previous.EntryCount());
+        previous.Close();
+        return index.Open(index_path);
+    }
+    previous.Close();
+    if (!builder.Save(index_path))
+    {
+        printf("Could not write index: %s\n", index_path.string().c_str());
+        return false;
+    }
+    printf("[Index] %s: %u archives, %u entries, %u rescanned, %u reused\n", index_path.string().c_str(),
+        builder.ArchiveCount(), builder.EntryCount(), rescanned, reused);
+    return index.Open(index_path);
+}
+
+// Drop the archives of a directory run that the index shows would have nothing to do: every
+// entry is either not selected by --filter or, with --incremental, already in the dump
+// directory's manifest with the same contents and name, and the manifest holds nothing the
+// run would prune. Their stamps were checked by update_global_index, so they are neither
+// mapped nor walked.
+static void skip_settled_archives(vector<DumpJob>& jobs, const GlobalIndex& index, const ExtractOptions& opt)
+{
+    if (opt.verify || !opt.pack.empty() || !opt.dependency_roots.empty() || (!opt.incremental && opt.filters.empty()))
+        return;
+    size_t before = jobs.size();
+    erase_if(jobs, [&](const DumpJob& job) {
+        uint32_t a = index.FindArchive(job.filepath.filename().string());
+        if (a == UINT32_MAX)
+            return false;
+        Manifest previous;
+        previous.Load(job.dump_path / Manifest::kFileName);
+        size_t recorded = 0;
+        for (auto& e : index.Entries(a))
+        {
+            ManifestRecord current;
+            current.id = e.id;
+            memcpy(current.hash, e.hash, sizeof(current.hash));
+            current.timestamp = e.timestamp;
+            current.sizeOnDisk = e.sizeOnDisk;
+            current.sizeInMemory = e.sizeInMemory;
+            auto old = previous.Find(e.id);
+            bool same = old && old->SameContent(current);
+            if (old && !same)
+                return false;
+            recorded += same;
+            bool selected = true;
+            if (!opt.filters.empty())
+            {
+                const string* depot_path = opt.paths ? opt.paths->Find(e.id) : nullptr;
+                selected = false;
+                for (size_t k = 0; depot_path && !selected && k < opt.filters.size(); k++)
+                    selected = PathDictionary::GlobMatch(opt.filters[k], *depot_path);
+            }
+            if (selected && !(opt.incremental && same && old->name == output_name(opt.paths, e.id).generic_string()))
+                return false;
+        }
+        return recorded == previous.Records().size();
+    });
+    printf("[Index] %zu of %zu archives have nothing to do, not opened\n", before - jobs.size(), before);
+}
+
+static void print_index_lookup(const GlobalIndex& index, uint64_t id)
+{
+    const GlobalIndexEntry* e = index.Find(id);
+    if (!e)
+    {
+        printf("%llu: not found\n", (unsigned long long)id);
+        return;
+    }
+    char sha1[41];
+    for (int k = 0; k < 20; k++)
+        snprintf(sha1 + k * 2, 3, "%02x", e->hash[k]);
+    string archive(index.ArchiveName(e->archive));
+    printf("%llu: %s entry %u, segments [%u, %u), size: %llu/%llu, sha1: %s\n", (unsigned long long)id, archive.c_str(), e->entryIndex,
+        e->segmentsStart, e->segmentsEnd, (unsigned long long)e->sizeOnDisk, (unsigned long long)e->sizeInMemory, sha1);
+}
+
+// Rebuild the CR2W metadata index when any archive differs from the one it was built from.
+// Postings of all archives share one string table, so a change means a full rescan.
+static bool update_cr2w_index(const vector<filesystem::path>& paths, const filesystem::path& index_path, uint32_t threads, CR2WIndex& index)
+{
+    vector<unique_ptr<MappedArchiveFile>> files;
+    vector<string> names;
+    vector<uint64_t> crcs;
+    for (auto&& path : paths)
+    {
+        auto file = make_unique<MappedArchiveFile>();
+        MappedArchiveFile::Options map_opt;
+        map_opt.sequential = false;
+        uint64_t crc64 = 0;
+        if (!file->Open(path, map_opt) || !ArchiveTablesInBounds(file->Data(), file->Size())
+            || !GetArchiveStamp(file->Data(), file->Size(), crc64))
+        {
+            printf("Not a RADR archive: %s\n", path.string().c_str());
+            continue;
+        }
+        files.push_back(move(file));
+        names.push_back(path.filename().string());
+        crcs.push_back(crc64);
+    }
+
+    if (index.Open(index_path) && index.ArchiveCount() == files.size())
+    {
+        bool same = true;
+        for (uint32_t a = 0; a < files.size() && same; a++)
+            same = index.ArchiveName(a) == names[a] && index.Archive(a).fileSize == files[a]->Size()
+                && index.Archive(a).crc64 == crcs[a];
+        if (same)
+        {
+            printf("[CR2W index] %s: %u archives, %llu CR2W files, %u strings, up to date\n", index_path.string().c_str(), index.ArchiveCount(),
+                (unsigned long long)index.CR2WFiles(), index.StringCount());
+            return true;
+        }
+    }
+    index.Close();
+
+    auto start = chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    CR2WIndexBuilder builder;
+    for (size_t a = 0; a < files.size(); a++)
+    {
+        RedArchive archive(files[a]->Data());
+        builder.AddArchive(names[a], files[a]->Size(), archive, &pool);
+    }
+    if (!builder.Save(index_path))
+    {
+        printf("Could not write CR2W index: %s\n", index_path.string().c_str());
+        return false;
+    }
+    printf("[CR2W index] %s: %u archives, %llu CR2W files, %zu strings, built in %.2fs\n", index_path.string().c_str(), builder.ArchiveCount(),
+        (unsigned long long)builder.CR2WFiles(), builder.StringCount(), chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    return index.Open(index_path);
+}
+
+// KIND:VALUE with KIND class, import or property
+static bool print_cr2w_query(const CR2WIndex& index, const string& query, PathDictionary* paths)
+{
+    static const char* kinds[CR2WIndex::kKindCount] = { "class", "import", "property" };
+    size_t colon = query.find(':');
+    int kind = 0;
+    while (kind < CR2WIndex::kKindCount && query.compare(0, colon, kinds[kind]) != 0)
+        kind++;
+    if (colon == string::npos || kind == CR2WIndex::kKindCount)
+    {
+        printf("Bad query, expected class:NAME, import:PATH or property:NAME: %s\n", query.c_str());
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    auto ids = index.Find(CR2WIndex::Kind(kind), string_view(query).substr(colon + 1));
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("[Query] %s: %zu files, %.3f ms\n", query.c_str(), ids.size(), ms);
+    for (auto id : ids)
+    {
+        const string* path = paths ? paths->Find(id) : nullptr;
+        printf("%llu%s%s\n", (unsigned long long)id, path ? " " : "", path ? path->c_str() : "");
+    }
+    return true;
+}
+
+struct ListOptions {
+    filesystem::path file;      // per entry rows, JSON if it ends in .json, CSV otherwise, "-" = CSV on stdout
+    bool stats = false;         // per archive summary on stdout
+    bool codecs = false;        // read the frame magic of compressed segments, one page per segment
+    PathDictionary* paths = nullptr;
+};
+
+// totals of one archive, per codec when the frames are read
+struct ListSummary {
+    uint64_t entries = 0;
+    uint64_t segments = 0;
+    uint64_t dependencies = 0;
+    uint64_t storedSegments = 0;
+    uint64_t sizeOnDisk = 0;
+    uint64_t sizeInMemory = 0;
+    map<string, array<uint64_t, 3>> codecs;    // segments, on disk, in memory
+};
+
+static string json_escape(const string& s)
+{
+    string out;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (uint8_t(c) < 0x20)
+        {
+            char u[8];
+            snprintf(u, sizeof(u), "\\u%04x", c);
+            out += u;
+            continue;
+        }
+        out += c;
+    }
+    return out;
+}
+
+// registered codecs by name, anything else by its magic
+static string codec_name(uint32_t magic)
+{
+    if (const char* registered = CodecRegistry::Instance().Name(magic))
+        return registered;
+    char name[5] = { char(magic >> 24), char(magic >> 16), char(magic >> 8), char(magic), 0 };
+    for (int k = 0; k < 4; k++)
+        if (uint8_t(name[k]) < 0x20 || uint8_t(name[k]) > 0x7e)
+            name[k] = '?';
+    return name;
+}
+
+// Only the header, index and the entry, segment and dependency tables are read; segment
+// payloads are never touched unless opt.codecs asks for the 4 byte magic of each frame.
+static bool list_archive(const filesystem::path& filepath, const ListOptions& opt, FILE* out, bool json, bool first_archive)
+{
+    MappedArchiveFile file;
+    MappedArchiveFile::Options map_opt;
+    map_opt.sequential = false;
+    if (!file.Open(filepath, map_opt) || file.Size() < sizeof(RedArchiveHeader))
+    {
+        printf("Not a RADR archive: %s\n", filepath.string().c_str());
+        return false;
+    }
+    auto header = reinterpret_cast<const RedArchiveHeader*>(file.Data());
+    file.AdviseWillNeed(header->indexPosition, header->indexSize);
+    if (!ArchiveTablesInBounds(file.Data(), file.Size()))
+    {
+        printf("Not a RADR archive: %s\n", filepath.string().c_str());
+        return false;
+    }
+    RedArchive archive(file.Data());
+    string name = filepath.filename().string();
+
+    ListSummary sum;
+    sum.entries = archive.fileTable->fileEntryCount;
+    sum.segments = archive.fileTable->fileSegmentCount;
+    sum.dependencies = archive.fileTable->resourceDependencyCount;
+    if (out && json)
+        fprintf(out, "%s  {\n    \"name\": \"%s\",\n    \"files\": [", first_archive ? "" : ",\n", json_escape(name).c_str());
+    for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
+    {
+        auto& fentry = archive.entry[i];
+        uint64_t disk = 0, mem = 0;
+        string codec = "stored";
+        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+        {
+            auto& fseg = archive.segment[seg_index];
+            disk += fseg.sizeOnDisk;
+            mem += fseg.sizeInMemory;
+            string seg_codec = "stored";
+            if (fseg.sizeOnDisk == fseg.sizeInMemory)
+                sum.storedSegments++;
+            else if (!opt.codecs)
+                seg_codec = "compressed";
+            else if (fseg.position + sizeof(uint32_t) <= file.Size())
+                seg_codec = codec_name(archive.Get<RedArchiveCompressed>(fseg.position)->magic);
+            else
+                seg_codec = "invalid";
+            auto& c = sum.codecs[seg_codec];
+            c[0]++;
+            c[1] += fseg.sizeOnDisk;
+            c[2] += fseg.sizeInMemory;
+            if (codec == "stored")
+                codec = seg_codec;
+        }
+        sum.sizeOnDisk += disk;
+        sum.sizeInMemory += mem;
+        if (!out)
+            continue;
+
+        const string* depot_path = opt.paths ? opt.paths->Find(fentry.id) : nullptr;
+        uint32_t segments = fentry.segmentsEnd - fentry.segmentsStart;
+        uint32_t dependencies = fentry.resourceDependenciesEnd - fentry.resourceDependenciesStart;
+        if (json)
+        {
+            fprintf(out, "%s\n      { \"index\": %u, \"id\": %llu, \"timestamp\": %llu, \"segments\": %u, \"inlineBuffers\": %u, \"sizeOnDisk\": %llu, \"sizeInMemory\": %llu, \"codec\": \"%s\", \"dependencies\": %u",
+                i ? "," : "", i, (unsigned long long)fentry.id, (unsigned long long)fentry.timestamp, segments, fentry.numInlineBufferSegments,
+                (unsigned long long)disk, (unsigned long long)mem, codec.c_str(), dependencies);
+            if (depot_path)
+                fprintf(out, ", \"path\": \"%s\"", json_escape(*depot_path).c_str());
+            fputs(" }", out);
+        }
+        else
+        {
+            string quoted;
+            if (depot_path)
+            {
+                quoted = "\"";
+                for (char c : *depot_path)
+                    quoted += c == '"' ? string("\"\"") : string(1, c);
+                quoted += '"';
+            }
+            fprintf(out, "%s,%u,%llu,%llu,%u,%u,%llu,%llu,%s,%u,%s\n", name.c_str(), i, (unsigned long long)fentry.id,
+                (unsigned long long)fentry.timestamp, segments, fentry.numInlineBufferSegments, (unsigned long long)disk,
+                (unsigned long long)mem, codec.c_str(), dependencies, quoted.c_str());
+        }
+    }
+
+    double ratio = sum.sizeInMemory ? double(sum.sizeOnDisk) / double(sum.sizeInMemory) : 1.0;
+    if (out && json)
+    {
+        fprintf(out, "\n    ],\n    \"fileSize\": %llu, \"entries\": %llu, \"segments\": %llu, \"dependencies\": %llu, \"sizeOnDisk\": %llu, \"sizeInMemory\": %llu, \"ratio\": %.4f,\n    \"codecs\": {",
+            (unsigned long long)file.Size(), (unsigned long long)sum.entries, (unsigned long long)sum.segments, (unsigned long long)sum.dependencies,
+            (unsigned long long)sum.sizeOnDisk, (unsigned long long)sum.sizeInMemory, ratio);
+        bool first = true;
+        for (auto&& [codec, c] : sum.codecs)
+        {
+            fprintf(out, "%s \"%s\": { \"segments\": %llu, \"sizeOnDisk\": %llu, \"sizeInMemory\": %llu }", first ? "" : ",", codec.c_str(),
+                (unsigned long long)c[0], (unsigned long long)c[1], (unsigned long long)c[2]);
+            first = false;
+        }
+        fputs(" }\n  }", out);
+    }
+    if (opt.stats)
+    {
+        printf("[Stats] %s: %llu entries, %llu segments (%llu stored), %llu dependencies, %.1f MiB on disk, %.1f MiB in memory, ratio %.3f\n",
+            name.c_str(), (unsigned long long)sum.entries, (unsigned long long)sum.segments, (unsigned long long)sum.storedSegments,
+            (unsigned long long)sum.dependencies, double(sum.sizeOnDisk) / 1048576.0, double(sum.sizeInMemory) / 1048576.0, ratio);
+        for (auto&& [codec, c] : sum.codecs)
+            printf("[Stats]     %-10s %10llu segments, %10.1f MiB on disk, %10.1f MiB in memory, ratio %.3f\n", codec.c_str(),
+                (unsigned long long)c[0], double(c[1]) / 1048576.0, double(c[2]) / 1048576.0, c[2] ? double(c[1]) / double(c[2]) : 1.0);
+    }
+    return true;
+}
+
+static int list_archives(const vector<filesystem::path>& archives, const ListOptions& opt)
+{
+    FILE* out = nullptr;
+    bool json = opt.file.extension() == ".json";
+    if (opt.file == "-")
+        out = stdout;
+    else if (!opt.file.empty() && !(out = fopen(opt.file.string().c_str(), "wb")))
+    {
+        printf("Could not write %s\n", opt.file.string().c_str());
+        return 1;
+    }
+    if (out && json)
+        fputs("{\"archives\": [\n", out);
+    else if (out)
+        fputs("archive,index,id,timestamp,segments,inlineBuffers,sizeOnDisk,sizeInMemory,codec,dependencies,path\n", out);
+
+    int ret = 0;
+    bool first = true;
+    for (auto&& path : archives)
+    {
+        if (!list_archive(path, opt, out, json, first))
+            ret = 1;
+        else
+            first = false;
+    }
+    if (out && json)
+        fputs("\n]}\n", out);
+    if (out && out != stdout && fclose(out) != 0)
+    {
+        printf("Could not write %s\n", opt.file.string().c_str());
+        ret = 1;
+    }
+    return ret;
+}
+
+// Build an archive from a dump directory. A file named by a decimal number at the top level
+// gets that id, any other file the hash of its relative path as a depot path. CR2W buffers
+// (<name>_buf_<n>), the manifest and the content store are left out; dependencies are not
+// known here and stay empty.
+static int repack_directory(const filesystem::path& dir, const filesystem::path& archive_path, const RedArchiveWriter::Options& opt)
+{
+    vector<filesystem::path> files;
+    for (auto it = filesystem::recursive_directory_iterator(dir); it != filesystem::recursive_directory_iterator(); ++it)
+    {
+        auto name = it->path().filename().string();
+        if (it->is_directory() && name == ".cas")
+            it.disable_recursion_pending();
+        else if (it->is_regular_file() && name != Manifest::kFileName && name.find("_buf_") == string::npos)
+            files.push_back(it->path());
+    }
+    sort(files.begin(), files.end());
+
+    RedArchiveWriter writer;
+    if (!writer.Open(archive_path, opt))
+    {
+        printf("Could not write %s\n", archive_path.string().c_str());
+        return 1;
+    }
+    auto start = chrono::steady_clock::now();
+    for (auto&& file : files)
+    {
+        auto relative = file.lexically_relative(dir);
+        string name = relative.generic_string();
+        bool numeric = !name.empty() && name.find_first_not_of("0123456789") == string::npos;
+        replace(name.begin(), name.end(), '/', '\\');
+        uint64_t id = numeric ? strtoull(name.c_str(), nullptr, 10) : PathDictionary::Hash(name);
+
+        ifstream ifs(file, ios::binary);
+        vector<unsigned char> data(size_t(filesystem::file_size(file)));
+        ifs.read(reinterpret_cast<char*>(data.data()), streamsize(data.size()));
+        if (!ifs || !writer.Add(id, move(data)))
+        {
+            printf("Could not add %s\n", file.string().c_str());
+            return 1;
+        }
+    }
+    if (!writer.Finish())
+    {
+        printf("Could not write %s\n", archive_path.string().c_str());
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("[Repack] %s: %u entries, %.1f MiB -> %.1f MiB with %s in %.2fs\n", archive_path.string().c_str(), writer.EntryCount(),
+        double(writer.BytesIn()) / 1048576.0, double(writer.BytesOut()) / 1048576.0, RedArchiveWriter::CodecName(opt.codec), seconds);
+    return 0;
+}
+
+// the paths of this run join the known ones only now, outputs were named from the known ones
+static void save_harvested_paths(PathDictionary& paths, PathDictionary& harvested, const char* harvest_path)
+{
+    if (!harvest_path)
+        return;
+    paths.Merge(harvested);
+    if (paths.SaveText(harvest_path))
+        printf("[Paths] %zu paths saved to %s\n", paths.Size(), harvest_path);
+    else
+        printf("Could not write %s\n", harvest_path);
+}
+
+int main(int argc, const char** argv)
+{
+    ExtractOptions opt;
+    opt.memory_budget = 2048ull << 20;
+    PathDictionary paths;
+    PathDictionary harvested;
+    const char* harvest_path = nullptr;
+    const char* index_path = nullptr;
+    vector<uint64_t> find_ids;
+    const char* cr2w_index_path = nullptr;
+    vector<string> queries;
+    ListOptions list_opt;
+    filesystem::path repack_path;
+    RedArchiveWriter::Options repack_opt;
+    vector<const char*> args;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            opt.threads = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--mem-budget") == 0 && i + 1 < argc)
+            opt.memory_budget = strtoull(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--huge-pages") == 0)
+            opt.huge_pages = true;
+        else if (strcmp(argv[i], "--sync-io") == 0)
+            opt.async_io = false;
+        else if (strcmp(argv[i], "--incremental") == 0)
+            opt.incremental = true;
+        else if (strcmp(argv[i], "--prune") == 0)
+            opt.prune = true;
+        else if (strcmp(argv[i], "--dedup") == 0)
+            opt.dedup = true;
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+            opt.pack = argv[++i];
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+            opt.stream_threshold = strtoull(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--parallel-decode") == 0 && i + 1 < argc)
+            opt.parallel_decode = strtoull(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--direct-io") == 0 && i + 1 < argc)
+            opt.direct_io_threshold = strtoull(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--deps") == 0 && i + 1 < argc)
+            opt.dependency_roots.push_back(strtoull(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--paths") == 0 && i + 1 < argc)
+        {
+            size_t added = paths.LoadText(argv[++i]);
+            printf("[Paths] %zu paths loaded from %s\n", added, argv[i]);
+            opt.paths = &paths;
+        }
+        else if (strcmp(argv[i], "--harvest-paths") == 0 && i + 1 < argc)
+        {
+            harvest_path = argv[++i];
+            if (filesystem::exists(harvest_path))
+                paths.LoadText(harvest_path);
+            opt.paths = &paths;
+            opt.harvest = &harvested;
+        }
+        else if (strcmp(argv[i], "--no-cr2w-check") == 0)
+            opt.check_cr2w = false;
+        else if (strcmp(argv[i], "--verify") == 0)
+            opt.verify = true;
+        else if (strcmp(argv[i], "-v") == 0)
+            opt.verbosity = max(opt.verbosity, 1);
+        else if (strcmp(argv[i], "-vv") == 0)
+            opt.verbosity = 2;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            opt.trace = argv[++i];
+            Telemetry::Instance().EnableTrace(true);
+        }
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+            opt.report = argv[++i];
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            opt.filters.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+            index_path = argv[++i];
+        else if (strcmp(argv[i], "--find") == 0 && i + 1 < argc)
+            find_ids.push_back(strtoull(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--cr2w-index") == 0 && i + 1 < argc)
+            cr2w_index_path = argv[++i];
+        else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc)
+            queries.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--list") == 0 && i + 1 < argc)
+            list_opt.file = argv[++i];
+        else if (strcmp(argv[i], "--stats") == 0)
+            list_opt.stats = true;
+        else if (strcmp(argv[i], "--codecs") == 0)
+            list_opt.codecs = true;
+        else if (strcmp(argv[i], "--repack") == 0 && i + 1 < argc)
+            repack_path = argv[++i];
+        else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc)
+        {
+            i++;
+            int codec = strcmp(argv[i], "none") == 0 ? RedArchiveWriter::kStored : -1;
+            for (int c = RedArchiveWriter::kStored; c <= RedArchiveWriter::kAuto && codec < 0; c++)
+                if (strcmp(argv[i], RedArchiveWriter::CodecName(RedArchiveWriter::Codec(c))) == 0)
+                    codec = c;
+            if (codec < 0)
+            {
+                printf("Unknown codec %s, expected kraken, lz4, zlib, stored (or none) or auto\n", argv[i]);
+                return 1;
+            }
+            repack_opt.codec = RedArchiveWriter::Codec(codec);
+        }
+        else
+            args.push_back(argv[i]);
+    }
+    if (opt.threads == 0)
+        opt.threads = max(1u, thread::hardware_concurrency());
+
+    if (args.empty()) {
+        printf("Usage:\n"
+                "    %s [-j N] [--mem-budget MB] [--huge-pages] [--sync-io] [--direct-io MB] [--stream MB] [--parallel-decode MB] [--pack FILE] [--incremental] [--prune] [--dedup] [--deps ID]... [--paths FILE] [--harvest-paths FILE] [--filter GLOB]... [--verify] [--no-cr2w-check] [-v|-vv] [--trace FILE] [--report FILE] [--index FILE [--find ID]...] [--cr2w-index FILE [--query KIND:VALUE]...] [--list FILE] [--stats] [--codecs] [--repack FILE [--codec NAME]] InputFileOrDir [OutputDir]\n\n"
+                "    * default value of OutputDir is filename\n"
+                "    * -j N extracts with N threads, 0 for one per core\n"
+                "    * --mem-budget MB caps decompressed bytes in flight, 0 for no cap, default 2048\n"
+                "    * --huge-pages asks for transparent huge pages on the archive mappings (Linux)\n"
+                "    * --sync-io writes files one by one instead of batching them through io_uring (Linux)\n"
+                "    * --direct-io MB writes files of at least MB megabytes with O_DIRECT (Linux)\n"
+                "    * --stream MB decodes and writes (or hashes) entries of at least MB megabytes a segment at a time, 0 = never, default 64\n"
+                "    * --parallel-decode MB decodes the segments of entries of at least MB megabytes on all -j threads, 0 = never, default 16\n"
+                "    * --pack FILE writes everything into one tar file instead of OutputDir\n"
+                "    * --incremental skips entries that OutputDir's manifest shows as unchanged since the last run\n"
+                "    * --prune deletes outputs of entries that were removed or renamed since the last run\n"
+                "    * --dedup decodes entries with the same SHA-1 once and links the copies, blobs are kept in OutputDir/.cas\n"
+                "    * --deps ID extracts only resource ID and everything it depends on, may be repeated\n"
+                "    * --paths FILE loads depot paths (one per line), known entries are written under their path\n"
+                "    * --harvest-paths FILE adds the import paths of every extracted CR2W file to FILE\n"
+                "    * --filter GLOB extracts only entries whose depot path matches, * and ? within a folder, ** across folders\n"
+                "    * --verify checks every entry's SHA-1 and the file table crc64 without writing anything\n"
+                "    * --no-cr2w-check skips the bounds and crc32 checks done on CR2W files before unpacking them\n"
+                "    * -v prints a line per extracted entry, -vv the buffers of every CR2W file as well\n"
+                "    * --trace FILE writes a Chrome trace (chrome://tracing, Perfetto) of the map/read/decode/cr2w/write/hash stages\n"
+                "    * --report FILE writes the per stage counters and histograms and the per codec numbers as JSON\n"
+                "    * --index FILE keeps a resource index of InputDir in FILE, only changed archives are rescanned, archives with nothing to do are skipped\n"
+                "    * --find ID looks the resource up in the index and prints where it lives instead of extracting\n"
+                "    * --cr2w-index FILE keeps an index of the export classes, import paths and property names of every CR2W file in FILE\n"
+                "    * --query KIND:VALUE lists the CR2W files with export class (class:), import path (import:) or property name (property:) VALUE\n"
+                "    * --list FILE writes one row per entry from the archive tables only, JSON if FILE ends in .json, CSV otherwise, - for stdout\n"
+                "    * --stats prints entry, segment and size totals and the compression ratio of every archive instead of extracting\n"
+                "    * --codecs with --list / --stats reads the codec magic of every compressed segment (one page each)\n"
+                "    * --repack FILE builds archive FILE from the dump directory InputDir, -j N compression threads\n"
+                "    * --codec NAME codec of --repack: kraken (needs Oodle), lz4, zlib, stored (or none), default auto = kraken if Oodle loads, lz4 otherwise\n", filesystem::path(argv[0]).filename().string().c_str());
+        return 1;
+    }
+
+    filesystem::path filepath = args[0];
+    if (!filesystem::exists(filepath))
+    {
+        printf("File dor dir not exists\n");
+        return 1;
+    }
+
+    if (!list_opt.file.empty() || list_opt.stats)
+    {
+        list_opt.paths = opt.paths;
+        vector<filesystem::path> archives;
+        if (filesystem::is_regular_file(filepath))
+            archives.push_back(filepath);
+        else
+            for (const auto& fp : filesystem::directory_iterator(filepath))
+                if (fp.path().extension() == ".archive")
+                    archives.push_back(fp.path());
+        sort(archives.begin(), archives.end());
+        return list_archives(archives, list_opt);
+    }
+
+    // not needed by the listings, and --list - keeps stdout to the CSV rows
+    if (!OodleHelper::Initialize())
+        printf("Oodle library not found, KRAK compressed segments will not be decoded\n");
+
+    if (cr2w_index_path)
+    {
+        vector<filesystem::path> archives;
+        if (filesystem::is_regular_file(filepath))
+            archives.push_back(filepath);
+        else
+            for (const auto& fp : filesystem::directory_iterator(filepath))
+                if (fp.path().extension() == ".archive")
+                    archives.push_back(fp.path());
+        sort(archives.begin(), archives.end());
+        CR2WIndex index;
+        if (!update_cr2w_index(archives, cr2w_index_path, opt.threads, index))
+            return 1;
+        int ret = 0;
+        for (auto& query : queries)
+            if (!print_cr2w_query(index, query, opt.paths))
+                ret = 1;
+        return ret;
+    }
+
+    if (!repack_path.empty())
+    {
+        repack_opt.threads = opt.threads;
+        return repack_directory(filepath, repack_path, repack_opt);
+    }
+
+    if (index_path && filesystem::is_regular_file(filepath))
+    {
+        printf("--index needs a directory: %s\n", filepath.string().c_str());
+        return 1;
+    }
+
+    vector<DumpJob> jobs;
+    if (filesystem::is_regular_file(filepath))
+    {
+        filesystem::path default_dump_path = filepath.stem();
+        filesystem::path dump_path;
+        if (args.size() >= 2)
+            dump_path = args[1];
+        else
+            dump_path = default_dump_path;
+        opt.store = dump_path / ".cas";
+        jobs.push_back({ filepath, dump_path });
+        int ret = extract_radr_archives(jobs, opt);
+        save_harvested_paths(paths, harvested, harvest_path);
+        return ret;
+    }
+
+    filesystem::path default_dump_path = "dump";
+    filesystem::path dump_path;
+    if (args.size() >= 2)
+        dump_path = args[1];
+    else
+        dump_path = default_dump_path;
+    opt.store = dump_path / ".cas";
+
+    if (index_path)
+    {
+        GlobalIndex index;
+        if (!update_global_index(filepath, index_path, index))
+            return 1;
+        if (!find_ids.empty())
+        {
+            for (auto id : find_ids)
+                print_index_lookup(index, id);
+            return 0;
+        }
+        // the archive list comes from the index, which has just been brought up to date
+        for (uint32_t a = 0; a < index.ArchiveCount(); a++)
+        {
+            filesystem::path fpath = filepath / index.ArchiveName(a);
+            jobs.push_back({ fpath, dump_path / fpath.stem() });
+        }
+        skip_settled_archives(jobs, index, opt);
+    }
+    else
+    {
+        for (const auto& fp : filesystem::directory_iterator(filepath))
+        {
+            const filesystem::path& fpath = fp.path();
+            if (fpath.extension() != ".archive")
+                continue;
+            // every archive gets its own subdirectory
+            jobs.push_back({ fpath, dump_path / fpath.stem() });
+        }
+    }
+    int ret = extract_radr_archives(jobs, opt);
+    save_harvested_paths(paths, harvested, harvest_path);
+    return ret;
+}
@@ -0,0 +1,1046 @@
+#include "RADR.hpp"
+#include "ArchiveExtract.hpp"
+#include "CR2W.hpp"
+#include "ContentStore.hpp"
+#include "DependencyGraph.hpp"
+#include "Sha1.hpp"
+#include "Telemetry.hpp"
+#include "OutputWriter.hpp"
+#include "ThreadPool.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <filesystem>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+
+using namespace std;
+
+struct DumpFlags {
+    bool name;
+    bool impt;
+    bool prop;
+    bool expt;
+    bool buffer;
+    bool embeded;
+};
+
+struct VerifyStats {
+    atomic<uint64_t> ok = 0;
+    atomic<uint64_t> mismatched = 0;
+    atomic<uint64_t> unhashed = 0;  // entries with an all zero hash
+    atomic<uint64_t> bytes = 0;
+};
+
+struct CR2WStats {
+    atomic<uint64_t> files = 0;
+    atomic<uint64_t> broken = 0;        // tables, chunks or strings outside the file, not unpacked
+    atomic<uint64_t> headerCrc = 0;
+    atomic<uint64_t> tableCrc = 0;
+    atomic<uint64_t> chunkCrc = 0;
+};
+
+struct StreamStats {
+    uint64_t threshold = 0;             // entries decoding to at least this many bytes are streamed
+    atomic<uint64_t> entries = 0;
+    atomic<uint64_t> bytes = 0;
+    atomic<uint64_t> fallbacks = 0;     // CR2W files, decoded whole after all
+    atomic<uint64_t> failed = 0;
+};
+
+struct DecodeStats {
+    atomic<uint64_t> shortEntries = 0;     // entries with a segment that did not decode
+};
+
+struct DedupStats {
+    uint64_t copies = 0;                // entries not decoded because their content is written elsewhere
+    uint64_t copyBytes = 0;
+    uint64_t placed[ContentStore::kPlacementCount] = {};
+};
+
+// state shared by every entry of a run
+struct ExtractContext {
+    DumpFlags flag;
+    OutputWriter* writer;
+    MemoryBudget* budget;
+    PathDictionary* paths;  // names outputs by depot path when the id is known, may be null
+    PathDictionary* harvest;  // collects the depot paths of CR2W imports, may be null
+    VerifyStats* verify;    // check hashes instead of writing files, may be null
+    CR2WStats* cr2w_check;  // validate CR2W files before touching their tables, may be null
+    ThreadPool* pool;       // decodes the buffers of one CR2W file concurrently, may be null
+    StreamStats* stream;    // large entries one segment at a time, may be null
+    DecodeStats* decode;
+    uint64_t parallel_decode;   // entries this big decode their segments on pool, 0 = never
+    bool replace_outputs;   // unlink before writing: outputs may be links into a content store
+    int verbosity;          // 0: summaries and warnings, 1: a line per entry, 2: CR2W buffers too
+};
+
+// false if the CR2W file must not be parsed
+static bool check_cr2w(CR2W* cr2w, uint64_t size, uint64_t id, ExtractContext& ctx)
+{
+    if (!ctx.cr2w_check)
+        return true;
+    CR2WCheck check = cr2w->Validate(size);
+    CR2WStats& st = *ctx.cr2w_check;
+    st.files++;
+    st.headerCrc += !check.headerCrcOk;
+    st.tableCrc += check.tableCrcFailures;
+    st.chunkCrc += check.chunkCrcFailures;
+    if (!check.structureOk)
+    {
+        st.broken++;
+        printf("[CR2W] %llu: tables, chunks or string offsets out of bounds, not unpacked\n", (unsigned long long)id);
+        return false;
+    }
+    if (!check.CrcOk())
+        printf("[CR2W] %llu: crc32 mismatch in%s%s%s\n", (unsigned long long)id, check.headerCrcOk ? "" : " header",
+            check.tableCrcFailures ? " tables" : "", check.chunkCrcFailures ? " chunks" : "");
+    return true;
+}
+
+filesystem::path output_name(PathDictionary* paths, uint64_t id)
+{
+    const string* depot_path = paths ? paths->Find(id) : nullptr;
+    if (!depot_path || depot_path->find("..") != string::npos)
+        return to_string(id);
+    filesystem::path name;
+    size_t start = 0;
+    while (start <= depot_path->size())
+    {
+        size_t end = depot_path->find('\\', start);
+        if (end == string::npos)
+            end = depot_path->size();
+        if (end > start)
+            name /= depot_path->substr(start, end - start);
+        start = end + 1;
+    }
+    return name.empty() ? filesystem::path(to_string(id)) : name;
+}
+
+static filesystem::path output_name(const ExtractContext& ctx, uint64_t id)
+{
+    return output_name(ctx.paths, id);
+}
+
+// Write one CR2W buffer. Stored buffers are written straight out of the file; compressed ones
+// carry the same magic / size framing as archive segments and are decoded to memSize first.
+// A buffer that fails to decode is written as it is on disk.
+static void extract_cr2w_buffer(CR2W* cr2w, const CR2WBuffer& ent, const filesystem::path& save_path,
+    const shared_ptr<unsigned char>& file_buffer, uint64_t id, ExtractContext& ctx)
+{
+    const unsigned char* raw = cr2w->Get<const unsigned char>(ent.offset);
+    const unsigned char* data = raw;
+    uint64_t size = ent.diskSize;
+    shared_ptr<const void> owner = file_buffer;
+
+    auto frame = reinterpret_cast<const RedArchiveCompressed*>(raw);
+    if (ent.diskSize != ent.memSize && ent.diskSize >= sizeof(RedArchiveCompressed) && frame->uncomp_size == ent.memSize)
+    {
+        // already inside an admitted entry, charge instead of waiting for the budget
+        uint64_t capacity = ent.memSize;
+        ctx.budget->Charge(capacity);
+        auto out = ctx.writer->AllocateBuffer(capacity, [budget = ctx.budget, capacity] { budget->Release(capacity); });
+        Telemetry::Scope decode(Telemetry::kDecode, capacity, id);
+        int64_t decoded = CodecRegistry::Instance().Decode(frame->magic, frame->data, ent.diskSize - sizeof(RedArchiveCompressed), out.get(), capacity);
+        if (decoded == int64_t(ent.memSize))
+        {
+            data = out.get();
+            size = ent.memSize;
+            owner = out;
+        }
+        else
+            printf("[Buffer]: %llu buffer %u could not be decoded, written as stored\n", (unsigned long long)id, ent.index);
+
+        if (ctx.cr2w_check && data != raw && Crc32::Compute(data, size_t(size)) != ent.crc32)
+        {
+            ctx.cr2w_check->chunkCrc++;
+            printf("[CR2W] %llu: crc32 mismatch in buffer %u\n", (unsigned long long)id, ent.index);
+        }
+    }
+    if (ctx.replace_outputs)
+    {
+        error_code ec;
+        filesystem::remove(save_path, ec);
+    }
+    ctx.writer->Enqueue({ save_path, data, size, owner });
+}
+
+// Touch every page of an entry's segments, so page faults on the mapping are timed as reads
+// rather than inside the decoder or the writer
+static void fault_in_entry(RedArchive& archive, uint32_t i)
+{
+    const RedArchiveEntry& fentry = archive.entry[i];
+    uint64_t bytes = 0;
+    for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+        bytes += archive.segment[seg_index].sizeOnDisk;
+    Telemetry::Scope read(Telemetry::kRead, bytes, fentry.id);
+    for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+    {
+        auto& fseg = archive.segment[seg_index];
+        auto p = archive.Get<const volatile unsigned char>(fseg.position);
+        for (uint64_t off = 0; off < fseg.sizeOnDisk; off += 4096)
+            (void)p[off];
+    }
+}
+
+// worth the tasks: a pool to run them, more than one segment and enough bytes
+static bool split_segments(RedArchive& archive, uint32_t i, const ExtractContext& ctx)
+{
+    const RedArchiveEntry& fentry = archive.entry[i];
+    return ctx.pool && ctx.parallel_decode && fentry.segmentsEnd - fentry.segmentsStart > 1
+        && archive.GetDecompressedSize(i) >= ctx.parallel_decode;
+}
+
+static RedArchive::ParallelFor pool_parallel_for(const ExtractContext& ctx)
+{
+    return [pool = ctx.pool](uint32_t count, const function<void(uint32_t)>& fn) { pool->ParallelFor(count, fn); };
+}
+
+static uint64_t decompress_entry(RedArchive& archive, uint32_t i, span<unsigned char> out, const ExtractContext& ctx, bool* compressed = nullptr)
+{
+    if (split_segments(archive, i, ctx))
+        return archive.DecompressFile(i, out, pool_parallel_for(ctx), compressed);
+    return archive.DecompressFile(i, out, compressed);
+}
+
+// segments that fail to decode are left out of an entry, name the entries that came out short
+static void check_decoded(RedArchive& archive, uint32_t i, uint64_t size, ExtractContext& ctx)
+{
+    uint64_t expected = archive.GetDecompressedSize(i);
+    if (size == expected)
+        return;
+    ctx.decode->shortEntries++;
+    printf("[Decode] %llu: %llu of %llu bytes decoded, failed segments left out\n", (unsigned long long)archive.entry[i].id,
+        (unsigned long long)size, (unsigned long long)expected);
+}
+
+static bool should_stream(RedArchive& archive, uint32_t i, const ExtractContext& ctx)
+{
+    return ctx.stream && archive.GetDecompressedSize(i) >= ctx.stream->threshold;
+}
+
+// Pass an entry from StreamFile to sink, the first segment through check first. Returns false
+// without calling sink if check rejects it: CR2W files are unpacked and hashed whole, they
+// take the buffered path. Decode time is the gap between two segments reaching the sink. Big
+// entries decode a window of segments at once, one per pool thread.
+static bool stream_entry(RedArchive& archive, uint32_t i, ExtractContext& ctx, const RedArchive::SegmentSink& sink)
+{
+    thread_local vector<unsigned char> scratch;
+    uint64_t id = archive.entry[i].id;
+    uint32_t window = split_segments(archive, i, ctx) ? ctx.pool->Size() : 1;
+    // a window of segments, charged without waiting: callers may hold admitted buffers
+    uint64_t largest = archive.GetLargestSegment(i) * window;
+    ctx.budget->Charge(largest);
+    bool first = true;
+    bool rejected = false;
+    bool stopped = false;
+    auto last = chrono::steady_clock::now();
+    auto pass_on = [&](span<const unsigned char> piece) {
+        Telemetry::Instance().Record(Telemetry::kDecode, last, chrono::steady_clock::now(), piece.size(), id);
+        if (first && piece.size() >= sizeof(uint32_t) && *reinterpret_cast<const uint32_t*>(piece.data()) == 'W2RC')
+        {
+            rejected = true;
+            return false;
+        }
+        first = false;
+        bool more = sink(piece);
+        stopped = !more;
+        last = chrono::steady_clock::now();
+        return more;
+    };
+    uint64_t passed;
+    if (window > 1)
+        passed = archive.StreamFile(i, pass_on, scratch, pool_parallel_for(ctx), window);
+    else
+        passed = archive.StreamFile(i, pass_on, scratch);
+    ctx.budget->Release(largest);
+    if (rejected)
+    {
+        ctx.stream->fallbacks++;
+        return false;
+    }
+    if (!stopped)
+        check_decoded(archive, i, passed, ctx);
+    ctx.stream->entries++;
+    return true;
+}
+
+// record, if not null, gets the output name and buffer count of what was written
+static void extract_entry(RedArchive& archive, uint32_t i, const filesystem::path& dump_path, ExtractContext& ctx, ManifestRecord* record = nullptr)
+{
+    const DumpFlags& flag = ctx.flag;
+    const RedArchiveEntry& fentry = archive.entry[i];
+    filesystem::path name = output_name(ctx, fentry.id);
+    if (name.has_parent_path() && !ctx.writer->Packing())
+        filesystem::create_directories(dump_path / name.parent_path());
+    if (ctx.replace_outputs)
+    {
+        error_code ec;
+        filesystem::remove(dump_path / name, ec);
+    }
+
+    // stored entries are written straight out of the mapping
+    auto view = archive.GetFileView(i);
+    bool stream = !view.data() && !ctx.writer->Packing() && should_stream(archive, i, ctx);
+    if (!stream)
+        fault_in_entry(archive, i);
+    if (view.data())
+    {
+        // stored CR2W files are not unpacked, but their imports still name other resources
+        if (ctx.harvest && view.size() >= sizeof(CR2W) && *reinterpret_cast<const uint32_t*>(view.data()) == 'W2RC')
+        {
+            Telemetry::Scope parse(Telemetry::kCR2W, view.size(), fentry.id);
+            auto cr2w = reinterpret_cast<CR2W*>(const_cast<unsigned char*>(view.data()));
+            if (check_cr2w(cr2w, view.size(), fentry.id, ctx))
+                ctx.harvest->Harvest(cr2w);
+        }
+        ctx.writer->Enqueue({ dump_path / name, view.data(), view.size() });
+        if (record)
+            record->name = name.generic_string();
+        if (ctx.verbosity >= 1)
+            printf("--------- Extract %s : %llu ---------\n", "uncompressed", (unsigned long long)fentry.id);
+        return;
+    }
+
+    if (stream)
+    {
+        // written from this thread as the segments come, the writer queue only takes whole files
+        ofstream of;
+        bool ok = true;
+        bool streamed = stream_entry(archive, i, ctx, [&](span<const unsigned char> piece) {
+            if (!of.is_open())
+                of.open(dump_path / name, ios::binary | ios::trunc);
+            Telemetry::Scope write(Telemetry::kWrite, piece.size(), fentry.id);
+            of.write(reinterpret_cast<const char*>(piece.data()), streamsize(piece.size()));
+            ctx.stream->bytes += piece.size();
+            return ok = bool(of);
+        });
+        if (streamed)
+        {
+            of.close();
+            if (!ok || !of)
+                ctx.stream->failed++;
+            else if (record)
+                record->name = name.generic_string();
+            if (ctx.verbosity >= 1)
+                printf("--------- Extract %s : %llu ---------\n", "streamed    ", (unsigned long long)fentry.id);
+            return;
+        }
+        fault_in_entry(archive, i);
+    }
+
+    // the buffer stays charged to the budget until its last write has finished
+    uint64_t capacity = archive.GetDecompressedSize(i);
+    ctx.budget->Acquire(capacity);
+    auto buffer = ctx.writer->AllocateBuffer(capacity, [budget = ctx.budget, capacity] { budget->Release(capacity); });
+    unsigned char* data = buffer.get();
+
+    bool compressed = false;
+    uint64_t size;
+    {
+        Telemetry::Scope decode(Telemetry::kDecode, capacity, fentry.id);
+        size = decompress_entry(archive, i, { data, size_t(capacity) }, ctx, &compressed);
+    }
+    check_decoded(archive, i, size, ctx);
+
+    ctx.writer->Enqueue({ dump_path / name, data, size, buffer });
+    if (record)
+        record->name = name.generic_string();
+
+    if (ctx.verbosity >= 1)
+        printf("--------- Extract %s : %llu ---------\n", (compressed ? "compressed  " : "uncompressed"), (unsigned long long)fentry.id);
+
+    if (!compressed)
+        return;
+
+    uint32_t magic = size >= sizeof(uint32_t) ? *reinterpret_cast<uint32_t*>(data) : 0;
+    if (magic == 'W2RC') // CR2W
+    {
+        // unpack CR2W files
+        auto cr2w = reinterpret_cast<CR2W*>(data);
+        {
+            Telemetry::Scope parse(Telemetry::kCR2W, size, fentry.id);
+            if (!check_cr2w(cr2w, size, fentry.id, ctx))
+                return;
+            if (ctx.harvest)
+                ctx.harvest->Harvest(cr2w);
+        }
+        #define ENT_OFFSET  reinterpret_cast<void*>( reinterpret_cast<uintptr_t>(&ent) - reinterpret_cast<uintptr_t>(cr2w))
+
+        if (flag.name || flag.impt || flag.prop || flag.expt)
+        {
+            CR2WView view(cr2w);
+            if (flag.name)
+            {
+                for (auto&& ent : view.Names())
+                {
+                    printf("[Name] %p %s, %x\n", ENT_OFFSET, view.String(ent.value), ent.hash);
+                }
+            }
+            if (flag.impt)
+            {
+                for (auto&& ent : view.Imports())
+                {
+                    if (!ent.flags)
+                        continue;
+                    printf("[Import] %p className: %s, depotPath: %s, flags: %x\n",
+                        ENT_OFFSET,
+                        view.TypeName(ent),
+                        view.DepotPath(ent),
+                        ent.flags);
+                }
+            }
+
+            if (flag.prop)
+            {
+                for (auto&& ent : view.Properties())
+                {
+                    printf("[Property] %p className: %s, propertyName: %s\n", ENT_OFFSET, view.TypeName(ent), view.PropertyName(ent));
+                }
+            }
+
+            if (flag.expt)
+            {
+                auto exports = view.Exports();
+                for (auto&& ent : exports)
+                {
+                    printf("[Export]: %p %s\n", ENT_OFFSET, view.ExportName(ent).c_str());
+                    auto parent = view.Parent(ent);
+                    if (parent)
+                        printf("    [Parent]: %s\n", view.ExportName(*parent).c_str());
+                    for (auto child : view.Children(ent))
+                    {
+                        printf("    [Child]: %s\n", view.ExportName(exports[child]).c_str());
+                    }
+                }
+            }
+        }
+
+        if (flag.buffer)
+        {
+            auto buffers = cr2w->entries<CR2WBuffer>();
+            vector<CR2WBuffer*> list;
+            for (auto&& ent : buffers)
+            {
+                if (ctx.verbosity >= 2)
+                    printf("[Buffer]: %p  index: %d, crc: %x, size: %d/%d\n", ENT_OFFSET, ent.index, ent.crc32, ent.diskSize, ent.memSize);
+                list.push_back(&ent);
+                if (record)
+                    record->buffers = max(record->buffers, ent.index + 1);
+            }
+            if (!list.empty() && !ctx.writer->Packing())
+                filesystem::create_directories((dump_path / name).parent_path());
+            auto extract_buffer = [&](uint32_t k) {
+                extract_cr2w_buffer(cr2w, *list[k], dump_path / filesystem::path(name.string() + "_buf_" + to_string(list[k]->index)), buffer, fentry.id, ctx);
+            };
+            if (ctx.pool && list.size() > 1)
+                ctx.pool->ParallelFor(uint32_t(list.size()), extract_buffer);
+            else
+                for (uint32_t k = 0; k < list.size(); k++)
+                    extract_buffer(k);
+        }
+
+        // BROKEN
+        if (flag.embeded)
+        {
+            for (auto&& ent : cr2w->entries<CR2WEmbedded>())
+            {
+                const char* x = "";
+                auto imp = ent.GetImport(cr2w);
+                if (imp)
+                    x = imp->GetDepotPath(cr2w);
+                printf("[Embedded]: %p  size: %d, path:%s, importDepotPath:%s\n", ENT_OFFSET, ent.dataSize, ent.GetPath(cr2w), x);
+            }
+        }
+    }
+    // any other compressed file has been written as decoded above, there is nothing to unpack
+}
+
+// Hash a group of entries against RedArchiveEntry::hash, writing nothing. Stored entries are
+// hashed in place, the rest is decompressed into per-thread scratch buffers; the group goes
+// through Sha1::HashMany together so the multi-buffer backend has lanes to fill.
+static constexpr size_t kVerifyGroup = 4;
+
+static void verify_entries(RedArchive& archive, const uint32_t* indices, size_t count, ExtractContext& ctx)
+{
+    thread_local vector<unsigned char> scratch[kVerifyGroup];
+    span<const unsigned char> messages[kVerifyGroup];
+    Sha1::Digest streamed[kVerifyGroup];
+    uint64_t streamed_bytes[kVerifyGroup] = {};
+    bool is_streamed[kVerifyGroup] = {};
+    bool is_buffered[kVerifyGroup] = {};
+    uint64_t charged = 0;
+    for (size_t k = 0; k < count; k++)
+    {
+        uint32_t i = indices[k];
+        messages[k] = archive.GetFileView(i);
+        if (!messages[k].data() && should_stream(archive, i, ctx))
+        {
+            Sha1::Stream sha1;
+            is_streamed[k] = stream_entry(archive, i, ctx, [&](span<const unsigned char> piece) {
+                Telemetry::Scope hash(Telemetry::kHash, piece.size(), archive.entry[i].id);
+                sha1.Update(piece.data(), piece.size());
+                streamed_bytes[k] += piece.size();
+                return true;
+            });
+            if (is_streamed[k])
+            {
+                sha1.Final(streamed[k]);
+                ctx.stream->bytes += streamed_bytes[k];
+                continue;
+            }
+        }
+        fault_in_entry(archive, i);
+        if (messages[k].data() || archive.GetDecompressedSize(i) == 0)
+            continue;
+        is_buffered[k] = true;
+        charged += archive.GetDecompressedSize(i);
+    }
+
+    // the whole group is admitted at once, waiting with part of it charged could wait on itself
+    ctx.budget->Acquire(charged);
+    for (size_t k = 0; k < count; k++)
+    {
+        if (!is_buffered[k])
+            continue;
+        uint32_t i = indices[k];
+        uint64_t capacity = archive.GetDecompressedSize(i);
+        scratch[k].resize(capacity);
+        Telemetry::Scope decode(Telemetry::kDecode, capacity, archive.entry[i].id);
+        uint64_t size = decompress_entry(archive, i, scratch[k], ctx);
+        check_decoded(archive, i, size, ctx);
+        messages[k] = { scratch[k].data(), size_t(size) };
+    }
+
+    Sha1::Digest digests[kVerifyGroup];
+    {
+        uint64_t bytes = 0;
+        for (size_t k = 0; k < count; k++)
+            bytes += messages[k].size();
+        Telemetry::Scope hash(Telemetry::kHash, bytes);
+        Sha1::HashMany({ messages, count }, digests);
+    }
+    ctx.budget->Release(charged);
+
+    static const uint8_t zero[20] = {};
+    for (size_t k = 0; k < count; k++)
+    {
+        const RedArchiveEntry& fentry = archive.entry[indices[k]];
+        if (is_streamed[k])
+            memcpy(digests[k], streamed[k], sizeof(Sha1::Digest));
+        ctx.verify->bytes += is_streamed[k] ? streamed_bytes[k] : messages[k].size();
+        if (memcmp(fentry.hash, zero, sizeof(zero)) == 0)
+            ctx.verify->unhashed++;
+        else if (memcmp(fentry.hash, digests[k], sizeof(Sha1::Digest)) == 0)
+            ctx.verify->ok++;
+        else
+        {
+            ctx.verify->mismatched++;
+            printf("[Verify] SHA-1 mismatch: %llu\n", (unsigned long long)fentry.id);
+        }
+        if (messages[k].size() >= sizeof(CR2W) && *reinterpret_cast<const uint32_t*>(messages[k].data()) == 'W2RC')
+        {
+            Telemetry::Scope parse(Telemetry::kCR2W, messages[k].size(), fentry.id);
+            check_cr2w(reinterpret_cast<CR2W*>(const_cast<unsigned char*>(messages[k].data())), messages[k].size(), fentry.id, ctx);
+        }
+    }
+}
+
+static void verify_file_table(RedArchive& archive, const filesystem::path& filepath)
+{
+    uint64_t stored = archive.fileTable->crc64;
+    uint64_t computed = archive.ComputeFileTableCrc64();
+    if (stored != computed)
+        printf("[Verify] %s: file table crc64 %016llx, computed %016llx (warning only)\n", filepath.filename().string().c_str(),
+            (unsigned long long)stored, (unsigned long long)computed);
+}
+
+// entry indices sorted by the position of their first segment, so walking them in order
+// reads the mapped archive front to back
+static vector<uint32_t> entries_in_position_order(RedArchive& archive)
+{
+    vector<uint32_t> order(archive.fileTable->fileEntryCount);
+    for (uint32_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    auto position = [&](uint32_t i) -> uint64_t {
+        auto& fentry = archive.entry[i];
+        return fentry.segmentsStart < fentry.segmentsEnd ? archive.segment[fentry.segmentsStart].position : 0;
+    };
+    stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return position(a) < position(b); });
+    return order;
+}
+
+static bool map_archive(DumpJob& job, const ExtractOptions& opt)
+{
+    Telemetry::Scope map(Telemetry::kMap);
+    job.file = make_unique<MappedArchiveFile>();
+    MappedArchiveFile::Options map_opt;
+    map_opt.hugePages = opt.huge_pages;
+    if (!job.file->Open(job.filepath, map_opt))
+    {
+        printf("Could not %s: %s: %d\n", job.file->ErrorStage(), job.filepath.string().c_str(), job.file->ErrorCode());
+        job.file.reset();
+        return false;
+    }
+    job.filesize = job.file->Size();
+
+    // the bounds check and RedArchive's constructor walk the whole index right away, fault it
+    // in eagerly; every table and segment range is checked before RedArchive trusts them
+    auto header = reinterpret_cast<const RedArchiveHeader*>(job.file->Data());
+    if (job.filesize >= sizeof(RedArchiveHeader))
+        job.file->AdviseWillNeed(header->indexPosition, header->indexSize);
+    if (!ArchiveTablesInBounds(job.file->Data(), job.filesize))
+    {
+        printf("Not a RADR archive: %s\n", job.filepath.string().c_str());
+        job.file.reset();
+        return false;
+    }
+
+    job.archive = make_unique<RedArchive>(job.file->Data());
+    map.SetBytes(job.filesize);
+
+    // only entries that are streamed are read front to back in one go, everything else is
+    // decoded whole by threads spread over the file and keeps the default readahead
+    RedArchive& archive = *job.archive;
+    for (uint32_t i = 0; opt.stream_threshold && i < archive.fileTable->fileEntryCount; i++)
+    {
+        auto& fentry = archive.entry[i];
+        if (fentry.segmentsStart >= fentry.segmentsEnd || archive.GetDecompressedSize(i) < opt.stream_threshold)
+            continue;
+        auto& first = archive.segment[fentry.segmentsStart];
+        auto& last = archive.segment[fentry.segmentsEnd - 1];
+        if (last.position >= first.position)
+            job.file->AdviseSequential(first.position, last.position + last.sizeOnDisk - first.position);
+    }
+    return true;
+}
+
+static void unmap_archive(DumpJob& job)
+{
+    job.archive.reset();
+    job.file.reset();
+}
+
+// Select the dependency closure of opt.dependency_roots across all mapped archives
+static void select_dependency_closure(vector<DumpJob*>& mapped, const ExtractOptions& opt)
+{
+    vector<RedArchive*> archives;
+    for (auto job : mapped)
+        archives.push_back(job->archive.get());
+    DependencyGraph graph;
+    graph.Build(archives);
+
+    vector<uint32_t> roots;
+    for (auto id : opt.dependency_roots)
+    {
+        uint32_t node = graph.Find(id);
+        if (node == DependencyGraph::kNoNode)
+            printf("[Deps] root %llu not found\n", (unsigned long long)id);
+        else
+            roots.push_back(node);
+    }
+
+    unique_ptr<ThreadPool> pool;
+    if (opt.threads > 1)
+        pool = make_unique<ThreadPool>(opt.threads);
+    auto closure = graph.Closure(roots, pool.get());
+
+    for (auto job : mapped)
+        job->selected.assign(job->archive->fileTable->fileEntryCount, 0);
+    uint64_t bytes = 0;
+    for (auto node : closure)
+    {
+        auto [a, i] = graph.Locate(node);
+        mapped[a]->selected[i] = 1;
+        bytes += mapped[a]->archive->GetDecompressedSize(i);
+    }
+    printf("[Deps] %zu roots, %u entries, %llu edges, %llu unresolved dependencies, closure: %zu entries, %.1f MiB\n",
+        roots.size(), graph.NodeCount(), (unsigned long long)graph.EdgeCount(), (unsigned long long)graph.Unresolved(),
+        closure.size(), double(bytes) / 1048576.0);
+}
+
+// Keep only entries whose depot path is known and matches one of opt.filters. Unselected
+// entries are never decompressed.
+static void select_by_filter(vector<DumpJob*>& mapped, const ExtractOptions& opt)
+{
+    uint64_t total = 0;
+    uint64_t matched = 0;
+    for (auto job : mapped)
+    {
+        RedArchive& archive = *job->archive;
+        uint32_t count = archive.fileTable->fileEntryCount;
+        if (job->selected.empty())
+            job->selected.assign(count, 1);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            total++;
+            if (!job->selected[i])
+                continue;
+            const string* depot_path = opt.paths ? opt.paths->Find(archive.entry[i].id) : nullptr;
+            bool match = false;
+            for (size_t k = 0; depot_path && !match && k < opt.filters.size(); k++)
+                match = PathDictionary::GlobMatch(opt.filters[k], *depot_path);
+            job->selected[i] = match;
+            matched += match;
+        }
+    }
+    printf("[Filter] %llu of %llu entries match\n", (unsigned long long)matched, (unsigned long long)total);
+}
+
+static bool is_selected(const DumpJob& job, uint32_t i)
+{
+    return job.selected.empty() || job.selected[i];
+}
+
+// Start the manifest of a dump directory from the one an earlier run left there. Entries not
+// extracted this time keep their record as long as the entry table still matches it; with
+// --incremental that also goes for selected entries written under the same name, which are
+// then deselected. Only the entry and segment tables are read.
+static void prepare_manifest(DumpJob& job, const ExtractOptions& opt, const ExtractContext& ctx)
+{
+    RedArchive& archive = *job.archive;
+    uint32_t count = archive.fileTable->fileEntryCount;
+    job.previous.Load(job.dump_path / Manifest::kFileName);
+    job.records.assign(count, {});
+    if (job.selected.empty())
+        job.selected.assign(count, 1);
+
+    uint32_t unchanged = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto current = ManifestRecord::FromEntry(archive, i);
+        auto old = job.previous.Find(current.id);
+        bool keep = old && old->SameContent(current)
+            && (!job.selected[i] || (opt.incremental && old->name == output_name(ctx, current.id).generic_string()));
+        if (keep && job.selected[i])
+        {
+            job.selected[i] = 0;
+            unchanged++;
+        }
+        job.records[i] = keep ? *old : move(current);
+    }
+    if (opt.incremental)
+        printf("[Manifest] %s: %u of %u entries unchanged\n", job.filepath.stem().string().c_str(), unchanged, count);
+}
+
+static ManifestRecord* manifest_record(DumpJob& job, uint32_t i)
+{
+    return job.records.empty() ? nullptr : &job.records[i];
+}
+
+// Entries of one SHA-1: owner is decoded as usual (null if the store already has the blob),
+// copies are deselected and placed from the store afterwards.
+struct DedupGroup {
+    string hex;
+    DumpJob* owner_job;
+    uint32_t owner;
+    vector<pair<DumpJob*, uint32_t>> copies;
+};
+
+static vector<DedupGroup> select_unique_content(vector<DumpJob*>& mapped, const ContentStore& store, DedupStats& stats)
+{
+    static const uint8_t zero[20] = {};
+    unordered_map<string, size_t> by_hash;
+    vector<DedupGroup> groups;
+    for (auto job : mapped)
+    {
+        RedArchive& archive = *job->archive;
+        for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
+        {
+            if (!is_selected(*job, i) || memcmp(archive.entry[i].hash, zero, sizeof(zero)) == 0)
+                continue;
+            string hex = ContentStore::Hex(archive.entry[i].hash);
+            auto [it, inserted] = by_hash.try_emplace(hex, groups.size());
+            if (inserted && !store.Has(hex))
+            {
+                groups.push_back({ move(hex), job, i, {} });
+                continue;
+            }
+            if (inserted)
+                groups.push_back({ move(hex), nullptr, 0, {} });
+            groups[it->second].copies.push_back({ job, i });
+            job->selected[i] = 0;
+            stats.copies++;
+            stats.copyBytes += archive.GetDecompressedSize(i);
+        }
+    }
+    erase_if(groups, [](const DedupGroup& g) { return g.copies.empty(); });
+    return groups;
+}
+
+// once every write has finished: move the owners into the store, then place the copies
+static void place_unique_content(vector<DedupGroup>& groups, ContentStore& store, const ExtractContext& ctx, DedupStats& stats)
+{
+    for (auto&& g : groups)
+    {
+        if (g.owner_job)
+        {
+            auto& r = g.owner_job->records[g.owner];
+            if (r.name.empty() || !store.Adopt(g.hex, g.owner_job->dump_path / r.name, r.buffers))
+            {
+                printf("[Dedup] %s could not be stored, %zu copies not written\n", g.hex.c_str(), g.copies.size());
+                stats.placed[ContentStore::kFailed] += g.copies.size();
+                continue;
+            }
+        }
+        for (auto [job, i] : g.copies)
+        {
+            filesystem::path name = output_name(ctx, job->archive->entry[i].id);
+            auto file = job->dump_path / name;
+            if (name.has_parent_path())
+                filesystem::create_directories(file.parent_path());
+            uint32_t buffers = 0;
+            auto how = store.Place(g.hex, file, &buffers);
+            stats.placed[how]++;
+            if (how != ContentStore::kFailed)
+            {
+                job->records[i].name = name.generic_string();
+                job->records[i].buffers = buffers;
+            }
+        }
+    }
+}
+
+// Remove the files of every previous record whose name this run does not keep. Names that
+// could reach outside the dump directory are left alone.
+static uint64_t prune_outputs(const DumpJob& job)
+{
+    unordered_set<string> kept;
+    for (auto&& r : job.records)
+        if (!r.name.empty())
+            kept.insert(r.name);
+    uint64_t removed = 0;
+    for (auto&& old : job.previous.Records())
+    {
+        if (kept.count(old.name) || old.name.find("..") != string::npos || filesystem::path(old.name).is_absolute())
+            continue;
+        for (auto&& file : old.Outputs())
+        {
+            error_code ec;
+            removed += filesystem::remove(job.dump_path / file, ec);
+        }
+    }
+    return removed;
+}
+
+// stage summary on stdout, --report and --trace files
+static void write_run_report(const ExtractOptions& opt, size_t archives, double seconds, uint64_t failed_writes, int ret)
+{
+    Telemetry& telemetry = Telemetry::Instance();
+    telemetry.PrintReport();
+    if (!opt.report.empty())
+    {
+        char run[256];
+        snprintf(run, sizeof(run), "\"run\": { \"archives\": %zu, \"threads\": %u, \"seconds\": %.6f, \"failedWrites\": %llu, \"exitCode\": %d },\n  ",
+            archives, opt.threads, seconds, (unsigned long long)failed_writes, ret);
+        if (!telemetry.WriteReport(opt.report, run + CodecRegistry::Instance().StatsJson()))
+            printf("Could not write %s\n", opt.report.string().c_str());
+    }
+    if (!opt.trace.empty() && !telemetry.WriteTrace(opt.trace))
+        printf("Could not write %s\n", opt.trace.string().c_str());
+}
+
+int extract_radr_archives(vector<DumpJob>& jobs, const ExtractOptions& opt)
+{
+    OutputWriter::Options out_opt;
+    out_opt.directThreshold = opt.direct_io_threshold;
+    out_opt.useUring = opt.async_io;
+    out_opt.packPath = opt.pack;
+    OutputWriter writer(out_opt);
+    if (writer.Packing() && writer.Failed())
+    {
+        printf("Cannot create %s\n", opt.pack.string().c_str());
+        return 1;
+    }
+    MemoryBudget budget(opt.memory_budget);
+    VerifyStats verify_stats;
+    CR2WStats cr2w_stats;
+    StreamStats stream_stats;
+    stream_stats.threshold = opt.stream_threshold;
+    DecodeStats decode_stats;
+    ExtractContext ctx{
+        .flag = { .buffer = true },
+        .writer = &writer,
+        .budget = &budget,
+        .paths = opt.paths,
+        .harvest = opt.harvest,
+        .verify = opt.verify ? &verify_stats : nullptr,
+        .cr2w_check = opt.check_cr2w ? &cr2w_stats : nullptr,
+        .pool = nullptr,
+        .stream = opt.stream_threshold ? &stream_stats : nullptr,
+        .decode = &decode_stats,
+        .parallel_decode = opt.parallel_decode,
+        .replace_outputs = false,
+        .verbosity = opt.verbosity,
+    };
+    DedupStats dedup_stats;
+    ContentStore store;
+    vector<DedupGroup> dedup_groups;
+    auto start = chrono::steady_clock::now();
+
+    int ret = 0;
+    vector<DumpJob*> mapped;
+    for (auto&& job : jobs)
+    {
+        if (!map_archive(job, opt))
+        {
+            ret = 1;
+            continue;
+        }
+        if (opt.verify)
+            verify_file_table(*job.archive, job.filepath);
+        else if (writer.Packing())
+            job.dump_path = job.filepath.stem();    // members are named <archive>/<entry>
+        else
+            filesystem::create_directories(job.dump_path);
+        mapped.push_back(&job);
+    }
+    if (!opt.dependency_roots.empty())
+        select_dependency_closure(mapped, opt);
+    if (!opt.filters.empty())
+        select_by_filter(mapped, opt);
+    if (!opt.verify && !writer.Packing())
+    {
+        for (auto job : mapped)
+            prepare_manifest(*job, opt, ctx);
+        // outputs of an earlier --dedup run may be hard links, never write through them
+        ctx.replace_outputs = opt.dedup || filesystem::exists(opt.store);
+        if (opt.dedup)
+        {
+            store.Open(opt.store);
+            dedup_groups = select_unique_content(mapped, store, dedup_stats);
+        }
+    }
+
+    if (opt.threads <= 1)
+    {
+        for (auto job : mapped)
+        {
+            RedArchive& archive = *job->archive;
+            printf("========== RADR Archive: %s ==========\n", job->filepath.stem().string().c_str());
+            if (ctx.verify)
+            {
+                vector<uint32_t> indices;
+                for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
+                    if (is_selected(*job, i))
+                        indices.push_back(i);
+                for (size_t k = 0; k < indices.size(); k += kVerifyGroup)
+                    verify_entries(archive, &indices[k], min(kVerifyGroup, indices.size() - k), ctx);
+                continue;
+            }
+            for (uint32_t i = 0; i < archive.fileTable->fileEntryCount; i++)
+                if (is_selected(*job, i))
+                    extract_entry(archive, i, job->dump_path, ctx, manifest_record(*job, i));
+        }
+    }
+    else
+    {
+        stable_sort(mapped.begin(), mapped.end(), [](DumpJob* a, DumpJob* b) { return a->filesize > b->filesize; });
+
+        ThreadPool pool(opt.threads);
+        ctx.pool = &pool;
+        for (auto job : mapped)
+        {
+            // hand every worker a contiguous run of the position-sorted entries,
+            // stealing evens out the tail
+            RedArchive& archive = *job->archive;
+            printf("========== RADR Archive: %s ==========\n", job->filepath.stem().string().c_str());
+            auto order = entries_in_position_order(archive);
+            erase_if(order, [job](uint32_t i) { return !is_selected(*job, i); });
+            if (ctx.verify)
+            {
+                auto shared_order = make_shared<vector<uint32_t>>(move(order));
+                size_t n = shared_order->size();
+                for (size_t k = 0; k < n; k += kVerifyGroup)
+                {
+                    pool.Submit([&, job, shared_order, k] {
+                        verify_entries(*job->archive, &(*shared_order)[k], min(kVerifyGroup, shared_order->size() - k), ctx);
+                    }, uint32_t(k * pool.Size() / n));
+                }
+                continue;
+            }
+            for (size_t k = 0; k < order.size(); k++)
+            {
+                uint32_t i = order[k];
+                pool.Submit([&, job, i] { extract_entry(*job->archive, i, job->dump_path, ctx, manifest_record(*job, i)); },
+                    uint32_t(k * pool.Size() / order.size()));
+            }
+        }
+        pool.Wait();
+        ctx.pool = nullptr;
+    }
+
+    // queued writes may still point into the mappings
+    writer.Finish();
+    if (opt.dedup && !opt.verify && !writer.Packing())
+    {
+        place_unique_content(dedup_groups, store, ctx, dedup_stats);
+        auto decode = Telemetry::Instance().Total(Telemetry::kDecode);
+        double rate = decode.bytes ? double(decode.ns) / double(decode.bytes) : 0.0;
+        printf("[Dedup] %llu copies, %.1f MiB not decoded (~%.2fs of decode at this run's rate), %llu reflinked, %llu hard linked, %llu copied, %llu failed, %zu blobs stored\n",
+            (unsigned long long)dedup_stats.copies, double(dedup_stats.copyBytes) / 1048576.0, double(dedup_stats.copyBytes) * rate / 1e9,
+            (unsigned long long)dedup_stats.placed[ContentStore::kReflink], (unsigned long long)dedup_stats.placed[ContentStore::kHardLink],
+            (unsigned long long)dedup_stats.placed[ContentStore::kCopy], (unsigned long long)dedup_stats.placed[ContentStore::kFailed], store.Size());
+        if (dedup_stats.placed[ContentStore::kFailed])
+            ret = 1;
+    }
+    for (auto job : mapped)
+    {
+        if (job->records.empty())
+            continue;
+        if (opt.prune)
+            printf("[Manifest] %s: %llu obsolete files removed\n", job->filepath.stem().string().c_str(), (unsigned long long)prune_outputs(*job));
+        if (!Manifest::Save(job->dump_path / Manifest::kFileName, job->records))
+            printf("[Manifest] cannot write %s\n", (job->dump_path / Manifest::kFileName).string().c_str());
+    }
+    CodecRegistry::Instance().PrintStats();
+    if (decode_stats.shortEntries)
+    {
+        printf("[Decode] %llu entries came out short, segments that could not be decoded were left out\n",
+            (unsigned long long)decode_stats.shortEntries.load());
+        ret = 1;
+    }
+    if (stream_stats.entries || stream_stats.fallbacks)
+    {
+        printf("[Stream] %llu entries, %.1f MiB passed a segment at a time, %llu CR2W files decoded whole, %llu failed\n",
+            (unsigned long long)stream_stats.entries.load(), double(stream_stats.bytes) / 1048576.0,
+            (unsigned long long)stream_stats.fallbacks.load(), (unsigned long long)stream_stats.failed.load());
+        if (stream_stats.failed)
+            ret = 1;
+    }
+    if (cr2w_stats.files)
+    {
+        printf("[CR2W] %llu files checked with %s crc32, %llu broken, crc32 mismatches: %llu headers, %llu tables, %llu chunks\n",
+            (unsigned long long)cr2w_stats.files.load(), Crc32::Backend(), (unsigned long long)cr2w_stats.broken.load(),
+            (unsigned long long)cr2w_stats.headerCrc.load(), (unsigned long long)cr2w_stats.tableCrc.load(), (unsigned long long)cr2w_stats.chunkCrc.load());
+    }
+    if (opt.verify)
+    {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("[Verify] %llu ok, %llu mismatched, %llu without hash, %.1f MiB hashed with %s in %.2fs\n",
+            (unsigned long long)verify_stats.ok.load(), (unsigned long long)verify_stats.mismatched.load(),
+            (unsigned long long)verify_stats.unhashed.load(), double(verify_stats.bytes) / 1048576.0, Sha1::Backend(), seconds);
+        if (verify_stats.mismatched)
+            ret = 1;
+    }
+    if (writer.Failed())
+    {
+        printf("Failed to write %llu files\n", (unsigned long long)writer.Failed());
+        ret = 1;
+    }
+    write_run_report(opt, mapped.size(), chrono::duration<double>(chrono::steady_clock::now() - start).count(), writer.Failed(), ret);
+
+    for (auto job : mapped)
+        unmap_archive(*job);
+    return ret;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "Manifest.hpp"
+#include "MappedArchiveFile.hpp"
+#include "PathDictionary.hpp"
+
+#include <stdint.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// --------------------
+// Extraction of whole archives, the part of ArchiveDump that ArchiveBench measures as well.
+// Implemented in ArchiveExtract.cpp.
+
+// one mapped .archive and the directory its entries are dumped to
+struct DumpJob {
+    std::filesystem::path filepath;
+    std::filesystem::path dump_path;
+    uint64_t filesize = 0;
+    std::unique_ptr<MappedArchiveFile> file;
+    std::unique_ptr<RedArchive> archive;
+    std::vector<uint8_t> selected;          // entries to extract, empty = all
+    Manifest previous;                      // what an earlier run left in dump_path
+    std::vector<ManifestRecord> records;    // what dump_path holds after this run, empty = no manifest kept
+};
+
+struct ExtractOptions {
+    uint32_t threads = 1;
+    uint64_t memory_budget = 0;     // max decompressed bytes in flight, 0 = unlimited
+    bool huge_pages = false;
+    bool async_io = true;           // io_uring output stage where available
+    uint64_t stream_threshold = 64ull << 20;    // entries this big are decoded a segment at a time, 0 = never
+    uint64_t parallel_decode = 16ull << 20;     // entries this big decode their segments in parallel, 0 = never
+    uint64_t direct_io_threshold = 0;           // files at least this big bypass the page cache, 0 = never
+    std::vector<uint64_t> dependency_roots;     // extract only these ids and what they depend on
+    std::filesystem::path pack;     // stream every output into this tar file instead of OutputDir
+    bool incremental = false;       // skip entries the dump directory's manifest shows as unchanged
+    bool prune = false;             // delete outputs of entries that are gone or changed name
+    bool dedup = false;             // decode each SHA-1 once, place the other copies from store
+    std::filesystem::path store;    // content store of dedup, under the top output directory
+    std::vector<std::string> filters;   // extract only depot paths matching one of these globs
+    bool verify = false;                // check entry hashes and file tables, write nothing
+    bool check_cr2w = true;             // validate CR2W bounds and crc32 before unpacking
+    PathDictionary* paths = nullptr;
+    PathDictionary* harvest = nullptr;  // kept apart from paths so names do not depend on entry order
+    int verbosity = 0;
+    std::filesystem::path trace;        // Chrome trace of every timed stage, empty = none
+    std::filesystem::path report;       // JSON run report with the stage histograms, empty = none
+};
+
+// Extract every entry of every archive in one job pool. Archives are started largest
+// first, so one huge archive overlaps with the small ones instead of trailing behind.
+int extract_radr_archives(std::vector<DumpJob>& jobs, const ExtractOptions& opt);
+
+// Output name of an entry relative to its dump directory: the depot path if the dictionary
+// knows the id, the id otherwise. Paths that would climb out of the dump directory are not
+// trusted.
+std::filesystem::path output_name(PathDictionary* paths, uint64_t id);
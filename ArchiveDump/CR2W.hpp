@@ -1,230 +1,445 @@
-#pragma once
-
-#include <stdint.h>
-#include <string>
-#include <vector>
-#include <assert.h>
-
-// ---- CREDIT ----
-// WolvenKit: for CR2W structure
-
-
-
-// --------------------
-template<typename T>
-class IteratableStructs {
-public:
-    IteratableStructs(T* p, uint32_t count) : pstart(p), pend(p + count) {}
-    IteratableStructs() : pstart(nullptr), pend(nullptr) {}
-    T* begin() const { return pstart; }
-    T* end() const { return pend; };
-private:
-    T* pstart = nullptr;
-    T* pend = nullptr;
-};
-
-// --------------------
-
-#pragma pack(push, CR2W, 1)
-
-struct CR2WHeader {
-    uint32_t magic;
-    uint32_t version;
-    uint32_t flags;
-    uint64_t timestamp;
-    uint32_t buildVersion;
-    uint32_t fileSize;
-    uint32_t bufferSize;
-    uint32_t crc32;
-    uint32_t numChunks;
-};
-
-struct CR2WTableIndex {
-    uint32_t pos;
-    uint32_t count;
-    uint32_t crc32;
-};
-
-// ---- forward declaration ----
-struct CR2WStrings;
-struct CR2WName;
-struct CR2WImport;
-struct CR2WProperty;
-struct CR2WExport;
-struct CR2WBuffer;
-struct CR2WEmbedded;
-
-struct CR2W {
-    CR2WHeader header;
-    CR2WTableIndex  tables[10];
-
-public:
-    template<typename T>
-    T* Get(intptr_t offset, void* rel = nullptr)
-    {
-        if (rel == nullptr)
-            rel = this;
-        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(rel) + offset);
-    }
-
-    template<typename T>
-    T* GetTableEntry(int table_index, int entry_index) { return Get<T>(tables[table_index].pos) + entry_index; }
-
-    template<typename T>
-    constexpr int get_index_of_table()
-    {
-        constexpr int index = 
-            (std::is_same<T, CR2WStrings>::value)  ? 0 :
-            (std::is_same<T, CR2WName>::value)     ? 1 :
-            (std::is_same<T, CR2WImport>::value)   ? 2 :
-            (std::is_same<T, CR2WProperty>::value) ? 3 :
-            (std::is_same<T, CR2WExport>::value)   ? 4 :
-            (std::is_same<T, CR2WBuffer>::value)   ? 5 :
-            (std::is_same<T, CR2WEmbedded>::value) ? 6 :
-            -1;
-        static_assert(index != -1);
-        return index;
-    }
-
-    template<typename T>
-    IteratableStructs<T> entries()
-    {
-        int table_index = get_index_of_table<T>();
-        uint32_t table_pos = tables[table_index].pos;
-        uint32_t table_ent_count = tables[table_index].count;
-        if (table_pos && table_ent_count > 0)
-            return IteratableStructs<T> { Get<T>(table_pos), table_ent_count};
-        else
-            return IteratableStructs<T> {};
-    }
-
-    template<typename T>
-    T* entry(uint32_t index=0)
-    {
-        int table_index = get_index_of_table<T>();
-        uint32_t table_pos = tables[table_index].pos;
-        uint32_t table_ent_count = tables[table_index].count;
-        if (table_pos && table_ent_count > 0 && index < table_ent_count)
-            return Get<T>(table_pos)+ index;
-        else
-        {
-            assert(0);
-            return nullptr;
-        }
-    }
-
-};
-
-// --------------------
-struct CR2WStrings {
-    // char strings[0];       // sequential strings splited by null byte
-    const char* const GetString(int offset)
-    {
-        return reinterpret_cast<char*>(this) + offset;
-    }
-};
-
-struct CR2WName {
-    uint32_t value;
-    uint32_t hash;
-public:
-    const char* const GetName(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(value); }
-};
-
-struct CR2WImport {
-    uint32_t depotPath;
-    uint16_t className;
-    uint16_t flags;
-
-    const char* const GetTypeName(CR2W* ctx)  { return ctx->entry<CR2WName>(className)->GetName(ctx); }
-    const char* const GetDepotPath(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(depotPath); }
-    int64_t GetIndex(CR2W* ctx)
-    {
-        int64_t self_index = this - ctx->entry<CR2WImport>();
-        assert(self_index >= 0);
-        return self_index;
-    }
-};
-
-struct CR2WProperty {
-    uint16_t className;
-    uint16_t classFlags;
-    uint16_t propertyName;
-    uint16_t propertyFlags;
-    uint64_t hash;
-
-    const char* const GetTypeName(CR2W* ctx) { return ctx->entry<CR2WName>(className)->GetName(ctx); }
-    const char* const GetPropertyName(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(propertyName); }
-};
-
-struct CR2WExport {
-    uint16_t className;
-    uint16_t objectFlags;   // 0x2000: cooked
-    uint32_t parentID;      // parentID=1: first CR2WExport, parentID=0: no parent
-    uint32_t dataSize;
-    uint32_t dataOffset;
-    uint32_t tpl;           // template
-    uint32_t crc32;
-    
-    const char* const GetTypeName(CR2W* ctx) { return ctx->entry<CR2WName>(className)->GetName(ctx); }
-    std::string GetName(CR2W* ctx) { return std::string(GetTypeName(ctx)) + "#" + std::to_string(GetIndex(ctx)); }
-
-    int64_t GetIndex(CR2W* ctx)
-    {
-        int64_t self_index = this - ctx->entry<CR2WExport>();
-        assert(self_index >= 0);
-        return self_index;
-    }
-
-    CR2WExport* GetParent(CR2W* ctx)
-    {
-        if (parentID)
-            return ctx->entry<CR2WExport>(parentID - 1);
-        else
-            return nullptr;
-    }
-
-    std::vector<CR2WExport*> GetChildren(CR2W* ctx)
-    {
-        std::vector<CR2WExport*> children;
-        int64_t self_index = this - ctx->entry<CR2WExport>();
-        assert(self_index >= 0);
-        for (auto&& ent : ctx->entries<CR2WExport>())
-        {
-            if (ent.parentID  == self_index + 1)    // 1-based
-                children.push_back(&ent);
-        }
-        return children;
-    }
-};
-
-struct CR2WBuffer {
-    uint32_t flags;
-    uint32_t index;
-    uint32_t offset;
-    uint32_t diskSize;
-    uint32_t memSize;
-    uint32_t crc32;
-};
-
-
-// BORKEN
-struct CR2WEmbedded {
-    uint32_t importIndex;   // 1: first CR2WImport, 0: no import
-    uint32_t path;
-    uint64_t pathHash;
-    uint32_t dataOffset;
-    uint32_t dataSize;
-
-    CR2WImport* GetImport(CR2W* ctx)
-    {
-        if (importIndex)
-            return ctx->entry<CR2WImport>(importIndex - 1);
-        else
-            return nullptr;
-    }
-    const char* const GetPath(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(path); }
-};
-
-
-#pragma pack(pop, CR2W)
\ No newline at end of file
+#pragma once
+
+#include "Crc32.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <span>
+#include <string>
+#include <vector>
+#include <assert.h>
+
+// ---- CREDIT ----
+// WolvenKit: for CR2W structure
+
+
+
+// --------------------
+template<typename T>
+class IteratableStructs {
+public:
+    IteratableStructs(T* p, uint32_t count) : pstart(p), pend(p + count) {}
+    IteratableStructs() : pstart(nullptr), pend(nullptr) {}
+    T* begin() const { return pstart; }
+    T* end() const { return pend; };
+private:
+    T* pstart = nullptr;
+    T* pend = nullptr;
+};
+
+// --------------------
+
+#pragma pack(push, CR2W, 1)
+
+struct CR2WHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t timestamp;
+    uint32_t buildVersion;
+    uint32_t fileSize;
+    uint32_t bufferSize;
+    uint32_t crc32;
+    uint32_t numChunks;
+};
+
+struct CR2WTableIndex {
+    uint32_t pos;
+    uint32_t count;
+    uint32_t crc32;
+};
+
+// ---- forward declaration ----
+struct CR2WStrings;
+struct CR2WName;
+struct CR2WImport;
+struct CR2WProperty;
+struct CR2WExport;
+struct CR2WBuffer;
+struct CR2WEmbedded;
+
+// Result of CR2W::Validate. A structural failure (header, table, chunk or string offset
+// outside the file) means the pointers entries<T>() hands out cannot be trusted; CRC mismatches are reported
+// but the data is still usable.
+struct CR2WCheck {
+    bool structureOk = true;
+    bool headerCrcOk = true;
+    uint32_t tablesChecked = 0;
+    uint32_t tableCrcFailures = 0;
+    uint32_t chunksChecked = 0;     // export data and buffers
+    uint32_t chunkCrcFailures = 0;
+
+    bool CrcOk() const { return headerCrcOk && !tableCrcFailures && !chunkCrcFailures; }
+};
+
+struct CR2W {
+    CR2WHeader header;
+    CR2WTableIndex  tables[10];
+
+public:
+    template<typename T>
+    T* Get(intptr_t offset, void* rel = nullptr)
+    {
+        if (rel == nullptr)
+            rel = this;
+        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(rel) + offset);
+    }
+
+    template<typename T>
+    T* GetTableEntry(int table_index, int entry_index) { return Get<T>(tables[table_index].pos) + entry_index; }
+
+    template<typename T>
+    constexpr int get_index_of_table()
+    {
+        constexpr int index = 
+            (std::is_same<T, CR2WStrings>::value)  ? 0 :
+            (std::is_same<T, CR2WName>::value)     ? 1 :
+            (std::is_same<T, CR2WImport>::value)   ? 2 :
+            (std::is_same<T, CR2WProperty>::value) ? 3 :
+            (std::is_same<T, CR2WExport>::value)   ? 4 :
+            (std::is_same<T, CR2WBuffer>::value)   ? 5 :
+            (std::is_same<T, CR2WEmbedded>::value) ? 6 :
+            -1;
+        static_assert(index != -1);
+        return index;
+    }
+
+    template<typename T>
+    IteratableStructs<T> entries()
+    {
+        int table_index = get_index_of_table<T>();
+        uint32_t table_pos = tables[table_index].pos;
+        uint32_t table_ent_count = tables[table_index].count;
+        if (table_pos && table_ent_count > 0)
+            return IteratableStructs<T> { Get<T>(table_pos), table_ent_count};
+        else
+            return IteratableStructs<T> {};
+    }
+
+    template<typename T>
+    T* entry(uint32_t index=0)
+    {
+        int table_index = get_index_of_table<T>();
+        uint32_t table_pos = tables[table_index].pos;
+        uint32_t table_ent_count = tables[table_index].count;
+        if (table_pos && table_ent_count > 0 && index < table_ent_count)
+            return Get<T>(table_pos)+ index;
+        else
+        {
+            assert(0);
+            return nullptr;
+        }
+    }
+
+    CR2WCheck Validate(uint64_t file_size);
+};
+
+// --------------------
+struct CR2WStrings {
+    // char strings[0];       // sequential strings splited by null byte
+    const char* const GetString(int offset)
+    {
+        return reinterpret_cast<char*>(this) + offset;
+    }
+};
+
+struct CR2WName {
+    uint32_t value;
+    uint32_t hash;
+public:
+    const char* const GetName(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(value); }
+};
+
+struct CR2WImport {
+    uint32_t depotPath;
+    uint16_t className;
+    uint16_t flags;
+
+    const char* const GetTypeName(CR2W* ctx)  { return ctx->entry<CR2WName>(className)->GetName(ctx); }
+    const char* const GetDepotPath(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(depotPath); }
+    int64_t GetIndex(CR2W* ctx)
+    {
+        int64_t self_index = this - ctx->entry<CR2WImport>();
+        assert(self_index >= 0);
+        return self_index;
+    }
+};
+
+struct CR2WProperty {
+    uint16_t className;
+    uint16_t classFlags;
+    uint16_t propertyName;
+    uint16_t propertyFlags;
+    uint64_t hash;
+
+    const char* const GetTypeName(CR2W* ctx) { return ctx->entry<CR2WName>(className)->GetName(ctx); }
+    const char* const GetPropertyName(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(propertyName); }
+};
+
+struct CR2WExport {
+    uint16_t className;
+    uint16_t objectFlags;   // 0x2000: cooked
+    uint32_t parentID;      // parentID=1: first CR2WExport, parentID=0: no parent
+    uint32_t dataSize;
+    uint32_t dataOffset;
+    uint32_t tpl;           // template
+    uint32_t crc32;
+    
+    const char* const GetTypeName(CR2W* ctx) { return ctx->entry<CR2WName>(className)->GetName(ctx); }
+    std::string GetName(CR2W* ctx) { return std::string(GetTypeName(ctx)) + "#" + std::to_string(GetIndex(ctx)); }
+
+    int64_t GetIndex(CR2W* ctx)
+    {
+        int64_t self_index = this - ctx->entry<CR2WExport>();
+        assert(self_index >= 0);
+        return self_index;
+    }
+
+    CR2WExport* GetParent(CR2W* ctx)
+    {
+        if (parentID)
+            return ctx->entry<CR2WExport>(parentID - 1);
+        else
+            return nullptr;
+    }
+
+    std::vector<CR2WExport*> GetChildren(CR2W* ctx)
+    {
+        std::vector<CR2WExport*> children;
+        int64_t self_index = this - ctx->entry<CR2WExport>();
+        assert(self_index >= 0);
+        for (auto&& ent : ctx->entries<CR2WExport>())
+        {
+            if (ent.parentID  == self_index + 1)    // 1-based
+                children.push_back(&ent);
+        }
+        return children;
+    }
+};
+
+struct CR2WBuffer {
+    uint32_t flags;
+    uint32_t index;
+    uint32_t offset;
+    uint32_t diskSize;
+    uint32_t memSize;
+    uint32_t crc32;
+};
+
+
+// BORKEN
+struct CR2WEmbedded {
+    uint32_t importIndex;   // 1: first CR2WImport, 0: no import
+    uint32_t path;
+    uint64_t pathHash;
+    uint32_t dataOffset;
+    uint32_t dataSize;
+
+    CR2WImport* GetImport(CR2W* ctx)
+    {
+        if (importIndex)
+            return ctx->entry<CR2WImport>(importIndex - 1);
+        else
+            return nullptr;
+    }
+    const char* const GetPath(CR2W* ctx) { return ctx->entry<CR2WStrings>()->GetString(path); }
+};
+
+
+#pragma pack(pop, CR2W)
+
+
+// --------------------
+// Read-only view of one CR2W file, built once: table base pointers resolved up front, name
+// strings resolved per name entry, and the export tree as a CSR child list built in one
+// pass over parentID, so walking the whole tree is linear.
+class CR2WView {
+public:
+    explicit CR2WView(CR2W* cr2w) : cr2w(cr2w)
+    {
+        if (cr2w->tables[0].pos && cr2w->tables[0].count)
+        {
+            // only strings terminated inside the table are handed out
+            strings = cr2w->Get<const char>(cr2w->tables[0].pos);
+            strings_size = cr2w->tables[0].count;
+            while (strings_size && strings[strings_size - 1] != '\0')
+                strings_size--;
+        }
+        names = Table<CR2WName>(1);
+        imports = Table<CR2WImport>(2);
+        properties = Table<CR2WProperty>(3);
+        exports = Table<CR2WExport>(4);
+        buffers = Table<CR2WBuffer>(5);
+        embedded = Table<CR2WEmbedded>(6);
+
+        name_strings.resize(names.size());
+        for (size_t i = 0; i < names.size(); i++)
+            name_strings[i] = String(names[i].value);
+
+        // children of export i are child_index[child_start[i], child_start[i + 1]), in index order
+        child_start.assign(exports.size() + 1, 0);
+        for (auto&& ent : exports)
+            if (ent.parentID && ent.parentID <= exports.size())
+                child_start[ent.parentID]++;
+        for (size_t i = 1; i < child_start.size(); i++)
+            child_start[i] += child_start[i - 1];
+        child_index.resize(child_start.back());
+        std::vector<uint32_t> fill(child_start.begin(), child_start.end() - 1);
+        for (uint32_t i = 0; i < exports.size(); i++)
+        {
+            uint32_t parent = exports[i].parentID;
+            if (parent && parent <= exports.size())
+                child_index[fill[parent - 1]++] = i;
+        }
+    }
+
+    CR2W* File() const { return cr2w; }
+
+    std::span<CR2WName> Names() const { return names; }
+    std::span<CR2WImport> Imports() const { return imports; }
+    std::span<CR2WProperty> Properties() const { return properties; }
+    std::span<CR2WExport> Exports() const { return exports; }
+    std::span<CR2WBuffer> Buffers() const { return buffers; }
+    std::span<CR2WEmbedded> Embedded() const { return embedded; }
+
+    const char* String(uint32_t offset) const { return offset < strings_size ? strings + offset : ""; }
+    const char* Name(uint32_t name_index) const { return name_index < name_strings.size() ? name_strings[name_index] : ""; }
+
+    const char* TypeName(const CR2WImport& ent) const { return Name(ent.className); }
+    const char* DepotPath(const CR2WImport& ent) const { return String(ent.depotPath); }
+    const char* TypeName(const CR2WProperty& ent) const { return Name(ent.className); }
+    const char* PropertyName(const CR2WProperty& ent) const { return String(ent.propertyName); }
+    const char* TypeName(const CR2WExport& ent) const { return Name(ent.className); }
+
+    uint32_t Index(const CR2WExport& ent) const { return uint32_t(&ent - exports.data()); }
+    std::string ExportName(const CR2WExport& ent) const { return std::string(TypeName(ent)) + "#" + std::to_string(Index(ent)); }
+
+    const CR2WExport* Parent(const CR2WExport& ent) const
+    {
+        return ent.parentID && ent.parentID <= exports.size() ? &exports[ent.parentID - 1] : nullptr;
+    }
+
+    // export indices
+    std::span<const uint32_t> Children(const CR2WExport& ent) const
+    {
+        uint32_t i = Index(ent);
+        return { child_index.data() + child_start[i], child_start[i + 1] - child_start[i] };
+    }
+
+private:
+    template<typename T>
+    std::span<T> Table(int table_index) const
+    {
+        auto& t = cr2w->tables[table_index];
+        if (!t.pos || !t.count)
+            return {};
+        return { cr2w->Get<T>(t.pos), t.count };
+    }
+
+    CR2W* cr2w;
+    const char* strings = "";
+    uint32_t strings_size = 0;
+    std::span<CR2WName> names;
+    std::span<CR2WImport> imports;
+    std::span<CR2WProperty> properties;
+    std::span<CR2WExport> exports;
+    std::span<CR2WBuffer> buffers;
+    std::span<CR2WEmbedded> embedded;
+    std::vector<const char*> name_strings;
+    std::vector<uint32_t> child_start;
+    std::vector<uint32_t> child_index;
+};
+
+
+// Bounds of the header, the ten tables and every export / buffer chunk, and their crc32;
+// bounds of every string offset the name, import and property tables hold.
+// The header crc covers the header and the table index with crc32 set to 0xDEADBEEF, the
+// way WolvenKit writes it.
+inline CR2WCheck CR2W::Validate(uint64_t file_size)
+{
+    CR2WCheck check;
+    if (file_size < sizeof(CR2W))
+    {
+        check.structureOk = false;
+        return check;
+    }
+
+    CR2W head;
+    memcpy(&head, this, sizeof(CR2W));
+    head.header.crc32 = 0xDEADBEEF;
+    check.headerCrcOk = Crc32::Compute(&head, sizeof(CR2W)) == header.crc32;
+
+    // entry size per table, 0 for the tables nothing is known about
+    const uint32_t entry_size[10] = { 1, sizeof(CR2WName), sizeof(CR2WImport), sizeof(CR2WProperty),
+        sizeof(CR2WExport), sizeof(CR2WBuffer), sizeof(CR2WEmbedded), 0, 0, 0 };
+    bool table_ok[10] = {};
+    for (int t = 0; t < 10; t++)
+    {
+        uint64_t bytes = uint64_t(tables[t].count) * entry_size[t];
+        if (bytes == 0)
+            continue;
+        if (tables[t].pos < sizeof(CR2W) || tables[t].pos + bytes > file_size)
+        {
+            check.structureOk = false;
+            continue;
+        }
+        table_ok[t] = true;
+        check.tablesChecked++;
+        if (Crc32::Compute(Get<const unsigned char>(tables[t].pos), size_t(bytes)) != tables[t].crc32)
+            check.tableCrcFailures++;
+    }
+
+    // every string a name, import or property refers to starts inside the strings table, and
+    // the table ends in a terminator, so none of them runs past it
+    const uint32_t strings_size = table_ok[0] ? tables[0].count : 0;
+    if (strings_size && *Get<const char>(tables[0].pos + strings_size - 1) != '\0')
+        check.structureOk = false;
+    auto check_string = [&](uint32_t offset) {
+        if (offset >= strings_size)
+            check.structureOk = false;
+    };
+    if (table_ok[1])
+    {
+        for (auto&& ent : entries<CR2WName>())
+            check_string(ent.value);
+    }
+    if (table_ok[2])
+    {
+        for (auto&& ent : entries<CR2WImport>())
+            check_string(ent.depotPath);
+    }
+    if (table_ok[3])
+    {
+        for (auto&& ent : entries<CR2WProperty>())
+            check_string(ent.propertyName);
+    }
+
+    auto chunk = [&](uint64_t offset, uint64_t size, uint32_t crc32) {
+        if (offset + size > file_size)
+        {
+            check.structureOk = false;
+            return;
+        }
+        check.chunksChecked++;
+        if (Crc32::Compute(Get<const unsigned char>(intptr_t(offset)), size_t(size)) != crc32)
+            check.chunkCrcFailures++;
+    };
+    if (table_ok[4])
+    {
+        for (auto&& ent : entries<CR2WExport>())
+            if (ent.dataSize)
+                chunk(ent.dataOffset, ent.dataSize, ent.crc32);
+    }
+    if (table_ok[5])
+    {
+        // the crc of a compressed buffer is checked once it is decompressed
+        for (auto&& ent : entries<CR2WBuffer>())
+        {
+            if (ent.diskSize == ent.memSize)
+                chunk(ent.offset, ent.diskSize, ent.crc32);
+            else if (uint64_t(ent.offset) + ent.diskSize > file_size)
+                check.structureOk = false;
+        }
+    }
+    return check;
+}
\ No newline at end of file
@@ -0,0 +1,442 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "CR2W.hpp"
+#include "MappedArchiveFile.hpp"
+#include "PathDictionary.hpp"
+#include "ThreadPool.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// ---- On-disk CR2W metadata index over a directory of archives ----
+//
+// header | archives[archiveCount] | ids[idCount] | strings[stringCount] | keys[keyCount]
+//        | postings[postingCount] | archive names | string bytes
+//
+// Every class name, import depot path and property name of every CR2W file is interned once
+// into strings, sorted bytewise. A key is (kind, string) and owns a run of postings, each an
+// index into ids, the sorted resource ids of the CR2W files it occurs in. Keys are sorted by
+// kind, then string, so a lookup is two binary searches on the mapped file.
+
+#pragma pack(push, C2IX, 1)
+struct CR2WIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t archiveCount;
+    uint32_t idCount;
+    uint32_t stringCount;
+    uint32_t keyCount;
+    uint64_t postingCount;
+    uint64_t cr2wFiles;     // CR2W files scanned, including ones that had no keys
+    uint64_t namesSize;
+    uint64_t stringBytes;
+};
+
+struct CR2WIndexArchive {
+    // 0x18
+    uint64_t fileSize;      // stamp: archive file size
+    uint64_t crc64;         // stamp: RedArchiveFileTable::crc64
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+struct CR2WIndexString {
+    // 0x10
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct CR2WIndexKey {
+    // 0x18
+    uint32_t kind;
+    uint32_t string;
+    uint64_t firstPosting;
+    uint32_t postingCount;
+    uint32_t reserved;
+};
+#pragma pack(pop, C2IX)
+
+static constexpr uint32_t kCR2WIndexMagic = 'C2IX';
+static constexpr uint32_t kCR2WIndexVersion = 1;
+
+// --------------------
+// Read side, a mapped index file.
+class CR2WIndex {
+public:
+    enum Kind { kExportClass, kImportPath, kPropertyName, kKindCount };
+
+    static const char* KindName(Kind kind)
+    {
+        static const char* names[kKindCount] = { "export class", "import", "property" };
+        return names[kind];
+    }
+
+    bool Open(const std::filesystem::path& path)
+    {
+        Close();
+        MappedArchiveFile::Options map_opt;
+        map_opt.sequential = false;
+        if (!file.Open(path, map_opt))
+            return false;
+        auto base = reinterpret_cast<const unsigned char*>(file.Data());
+        uint64_t size = file.Size();
+        if (size < sizeof(CR2WIndexHeader))
+            return Fail();
+        header = reinterpret_cast<const CR2WIndexHeader*>(base);
+        if (header->magic != kCR2WIndexMagic || header->version != kCR2WIndexVersion)
+            return Fail();
+        uint64_t expected = sizeof(CR2WIndexHeader) + uint64_t(header->archiveCount) * sizeof(CR2WIndexArchive)
+            + uint64_t(header->idCount) * sizeof(uint64_t) + uint64_t(header->stringCount) * sizeof(CR2WIndexString)
+            + uint64_t(header->keyCount) * sizeof(CR2WIndexKey) + header->postingCount * sizeof(uint32_t)
+            + header->namesSize + header->stringBytes;
+        if (size != expected)
+            return Fail();
+        archives = reinterpret_cast<const CR2WIndexArchive*>(header + 1);
+        ids = reinterpret_cast<const uint64_t*>(archives + header->archiveCount);
+        strings = reinterpret_cast<const CR2WIndexString*>(ids + header->idCount);
+        keys = reinterpret_cast<const CR2WIndexKey*>(strings + header->stringCount);
+        postings = reinterpret_cast<const uint32_t*>(keys + header->keyCount);
+        names = reinterpret_cast<const char*>(postings + header->postingCount);
+        string_bytes = names + header->namesSize;
+
+        for (uint32_t i = 0; i < header->archiveCount; i++)
+            if (uint64_t(archives[i].nameOffset) + archives[i].nameLength > header->namesSize)
+                return Fail();
+        for (uint32_t i = 0; i < header->stringCount; i++)
+            if (strings[i].offset + strings[i].length > header->stringBytes)
+                return Fail();
+        for (uint32_t i = 0; i < header->keyCount; i++)
+            if (keys[i].kind >= kKindCount || keys[i].string >= header->stringCount
+                || keys[i].firstPosting + keys[i].postingCount > header->postingCount)
+                return Fail();
+        for (uint64_t p = 0; p < header->postingCount; p++)
+            if (postings[p] >= header->idCount)
+                return Fail();
+        return true;
+    }
+
+    void Close()
+    {
+        file.Close();
+        header = nullptr;
+        archives = nullptr;
+        ids = nullptr;
+        strings = nullptr;
+        keys = nullptr;
+        postings = nullptr;
+        names = nullptr;
+        string_bytes = nullptr;
+    }
+
+    bool IsOpen() const { return header != nullptr; }
+
+    uint32_t ArchiveCount() const { return header ? header->archiveCount : 0; }
+    const CR2WIndexArchive& Archive(uint32_t i) const { return archives[i]; }
+    std::string_view ArchiveName(uint32_t i) const { return { names + archives[i].nameOffset, archives[i].nameLength }; }
+    uint32_t StringCount() const { return header ? header->stringCount : 0; }
+    uint32_t KeyCount() const { return header ? header->keyCount : 0; }
+    uint64_t CR2WFiles() const { return header ? header->cr2wFiles : 0; }
+    std::string_view String(uint32_t i) const { return { string_bytes + strings[i].offset, strings[i].length }; }
+
+    // ids of the CR2W files where value occurs as kind, ascending. Import paths are compared
+    // after PathDictionary::Normalize.
+    std::vector<uint64_t> Find(Kind kind, std::string_view value) const
+    {
+        std::vector<uint64_t> found;
+        if (!header)
+            return found;
+        std::string normalized;
+        if (kind == kImportPath)
+            value = normalized = PathDictionary::Normalize(value);
+        const CR2WIndexString* first = strings;
+        const CR2WIndexString* last = strings + header->stringCount;
+        auto s = std::lower_bound(first, last, value, [this](const CR2WIndexString& e, std::string_view v) { return View(e) < v; });
+        if (s == last || View(*s) != value)
+            return found;
+        uint32_t string = uint32_t(s - first);
+        auto k = std::lower_bound(keys, keys + header->keyCount, std::make_pair(uint32_t(kind), string),
+            [](const CR2WIndexKey& e, std::pair<uint32_t, uint32_t> v) { return std::make_pair(e.kind, e.string) < v; });
+        if (k == keys + header->keyCount || k->kind != uint32_t(kind) || k->string != string)
+            return found;
+        for (uint64_t p = k->firstPosting; p < k->firstPosting + k->postingCount; p++)
+            found.push_back(ids[postings[p]]);
+        return found;
+    }
+
+private:
+    std::string_view View(const CR2WIndexString& s) const { return { string_bytes + s.offset, s.length }; }
+
+    bool Fail()
+    {
+        Close();
+        return false;
+    }
+
+    MappedArchiveFile file;
+    const CR2WIndexHeader* header = nullptr;
+    const CR2WIndexArchive* archives = nullptr;
+    const uint64_t* ids = nullptr;
+    const CR2WIndexString* strings = nullptr;
+    const CR2WIndexKey* keys = nullptr;
+    const uint32_t* postings = nullptr;
+    const char* names = nullptr;
+    const char* string_bytes = nullptr;
+};
+
+// --------------------
+// Write side. Archives are scanned chunk by chunk on the pool; every chunk interns its own
+// strings and the chunks are merged into the global table afterwards, so workers never
+// share a map. Only the first segment of an entry is decoded as long as the CR2W tables
+// fit into it, which is the usual case since inline buffers come in later segments.
+class CR2WIndexBuilder {
+public:
+    void AddArchive(const std::string& name, uint64_t file_size, RedArchive& archive, ThreadPool* pool)
+    {
+        archives.push_back({ file_size, archive.fileTable->crc64, uint32_t(names.size()), uint32_t(name.size()) });
+        names += name;
+
+        const uint32_t count = archive.fileTable->fileEntryCount;
+        const uint32_t chunks = (count + kChunk - 1) / kChunk;
+        std::vector<Chunk> results(chunks);
+        auto scan = [&](uint32_t c) {
+            thread_local std::vector<unsigned char> scratch;
+            for (uint32_t i = c * kChunk; i < (std::min)(count, (c + 1) * kChunk); i++)
+                ScanEntry(archive, i, scratch, results[c]);
+        };
+        if (pool)
+            pool->ParallelFor(chunks, scan);
+        else
+            for (uint32_t c = 0; c < chunks; c++)
+                scan(c);
+
+        for (auto& chunk : results)
+        {
+            cr2w_files += chunk.files;
+            std::vector<uint32_t> remap(chunk.strings.size());
+            for (size_t s = 0; s < chunk.strings.size(); s++)
+            {
+                auto [it, inserted] = interned.try_emplace(chunk.strings[s], uint32_t(values.size()));
+                if (inserted)
+                    values.push_back(chunk.strings[s]);
+                remap[s] = it->second;
+            }
+            for (auto& p : chunk.postings)
+                postings.push_back({ p.kind, remap[p.string], p.id });
+        }
+    }
+
+    // written next to the target and renamed over it, readers never see a partial file
+    bool Save(const std::filesystem::path& path)
+    {
+        // strings in bytewise order, so the reader can binary search them
+        std::vector<uint32_t> order(values.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return values[a] < values[b]; });
+        std::vector<uint32_t> rank(values.size());
+        std::vector<CR2WIndexString> table(values.size());
+        std::string bytes;
+        for (uint32_t r = 0; r < order.size(); r++)
+        {
+            rank[order[r]] = r;
+            table[r] = { bytes.size(), uint32_t(values[order[r]].size()), 0 };
+            bytes += values[order[r]];
+        }
+
+        std::vector<uint64_t> ids;
+        for (auto& p : postings)
+            ids.push_back(p.id);
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+        struct Row {
+            uint32_t kind;
+            uint32_t string;
+            uint32_t file;
+            bool operator<(const Row& o) const { return std::tie(kind, string, file) < std::tie(o.kind, o.string, o.file); }
+            bool operator==(const Row& o) const { return kind == o.kind && string == o.string && file == o.file; }
+        };
+        std::vector<Row> rows;
+        rows.reserve(postings.size());
+        for (auto& p : postings)
+            rows.push_back({ p.kind, rank[p.string], uint32_t(std::lower_bound(ids.begin(), ids.end(), p.id) - ids.begin()) });
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+        std::vector<CR2WIndexKey> keys;
+        std::vector<uint32_t> files;
+        files.reserve(rows.size());
+        for (auto& row : rows)
+        {
+            if (keys.empty() || keys.back().kind != row.kind || keys.back().string != row.string)
+                keys.push_back({ row.kind, row.string, files.size(), 0, 0 });
+            keys.back().postingCount++;
+            files.push_back(row.file);
+        }
+
+        CR2WIndexHeader header{ kCR2WIndexMagic, kCR2WIndexVersion, uint32_t(archives.size()), uint32_t(ids.size()), uint32_t(table.size()),
+            uint32_t(keys.size()), files.size(), cr2w_files, names.size(), bytes.size() };
+        auto tmp_path = path;
+        tmp_path += ".tmp";
+        {
+            std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(archives.data()), archives.size() * sizeof(CR2WIndexArchive));
+            ofs.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint64_t));
+            ofs.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(CR2WIndexString));
+            ofs.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(CR2WIndexKey));
+            ofs.write(reinterpret_cast<const char*>(files.data()), files.size() * sizeof(uint32_t));
+            ofs.write(names.data(), names.size());
+            ofs.write(bytes.data(), bytes.size());
+            if (!ofs)
+                return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path, ec);
+        return !ec;
+    }
+
+    uint32_t ArchiveCount() const { return uint32_t(archives.size()); }
+    uint64_t CR2WFiles() const { return cr2w_files; }
+    size_t StringCount() const { return values.size(); }
+
+private:
+    static constexpr uint32_t kChunk = 256;
+
+    struct Posting {
+        uint32_t kind;
+        uint32_t string;
+        uint64_t id;
+    };
+
+    // strings and postings of one run of entries, string indices are local to the chunk
+    struct Chunk {
+        std::vector<std::string> strings;
+        std::unordered_map<std::string, uint32_t> lookup;
+        std::vector<Posting> postings;
+        uint64_t files = 0;
+
+        void Add(uint32_t kind, std::string_view value, uint64_t id)
+        {
+            if (value.empty())
+                return;
+            auto [it, inserted] = lookup.try_emplace(std::string(value), uint32_t(strings.size()));
+            if (inserted)
+                strings.emplace_back(value);
+            postings.push_back({ kind, it->second, id });
+        }
+    };
+
+    static void ScanEntry(RedArchive& archive, uint32_t i, std::vector<unsigned char>& scratch, Chunk& chunk)
+    {
+        auto& fentry = archive.entry[i];
+        if (fentry.segmentsStart >= fentry.segmentsEnd)
+            return;
+        auto& first = archive.segment[fentry.segmentsStart];
+        std::span<const unsigned char> data;
+        if (first.sizeInMemory == first.sizeOnDisk)
+            data = { archive.Get<const unsigned char>(first.position), first.sizeOnDisk };
+        else
+        {
+            // the magic is in the first bytes, look at it before decoding anything else
+            if (first.sizeOnDisk < sizeof(RedArchiveCompressed))
+                return;
+            auto arc = archive.Get<RedArchiveCompressed>(first.position);
+            scratch.resize((std::max)(uint64_t(first.sizeInMemory), uint64_t(sizeof(CR2W))));
+            int64_t n = CodecRegistry::Instance().Decode(arc->magic, arc->data, first.sizeOnDisk - sizeof(RedArchiveCompressed), scratch.data(), first.sizeInMemory);
+            if (n <= 0)
+                return;
+            data = { scratch.data(), size_t(n) };
+        }
+        if (data.size() < sizeof(CR2W) || *reinterpret_cast<const uint32_t*>(data.data()) != 'W2RC')
+            return;
+        if (!TablesFit(data) && fentry.segmentsEnd - fentry.segmentsStart > 1)
+        {
+            std::vector<unsigned char> whole(archive.GetDecompressedSize(i));
+            whole.resize(archive.DecompressFile(i, whole));
+            scratch.swap(whole);
+            data = scratch;
+        }
+        if (!TablesFit(data))
+            return;
+
+        // tables copied out of a possibly unaligned, read only source
+        auto cr2w = reinterpret_cast<const CR2W*>(data.data());
+        auto& strings = cr2w->tables[0];
+        std::string_view pool(reinterpret_cast<const char*>(data.data()) + strings.pos, strings.count);
+        auto names = Table<CR2WName>(data, 1);
+        auto imports = Table<CR2WImport>(data, 2);
+        auto properties = Table<CR2WProperty>(data, 3);
+
+        // a string offset outside the pool is a broken file, the same as CR2W::Validate sees it
+        if (!pool.empty() && pool.back() != '\0')
+            return;
+        for (auto& ent : names)
+            if (ent.value >= pool.size())
+                return;
+        for (auto& ent : imports)
+            if (ent.depotPath >= pool.size())
+                return;
+        for (auto& ent : properties)
+            if (ent.propertyName >= pool.size())
+                return;
+        chunk.files++;
+
+        auto string_at = [&](uint64_t offset) -> std::string_view {
+            auto s = pool.substr(size_t(offset));
+            return s.substr(0, s.find('\0'));
+        };
+        auto name_at = [&](uint32_t index) -> std::string_view { return index < names.size() ? string_at(names[index].value) : std::string_view(); };
+
+        for (auto& ent : Table<CR2WExport>(data, 4))
+            chunk.Add(CR2WIndex::kExportClass, name_at(ent.className), fentry.id);
+        for (auto& ent : imports)
+            chunk.Add(CR2WIndex::kImportPath, PathDictionary::Normalize(string_at(ent.depotPath)), fentry.id);
+        for (auto& ent : properties)
+            chunk.Add(CR2WIndex::kPropertyName, string_at(ent.propertyName), fentry.id);
+    }
+
+    // the string, name, import, property and export tables lie inside data
+    static bool TablesFit(std::span<const unsigned char> data)
+    {
+        if (data.size() < sizeof(CR2W))
+            return false;
+        auto cr2w = reinterpret_cast<const CR2W*>(data.data());
+        const uint64_t entry_size[5] = { 1, sizeof(CR2WName), sizeof(CR2WImport), sizeof(CR2WProperty), sizeof(CR2WExport) };
+        for (int t = 0; t < 5; t++)
+        {
+            auto& table = cr2w->tables[t];
+            if (table.count && (table.pos < sizeof(CR2W) || table.pos + uint64_t(table.count) * entry_size[t] > data.size()))
+                return false;
+        }
+        return true;
+    }
+
+    template<typename T>
+    static std::vector<T> Table(std::span<const unsigned char> data, int t)
+    {
+        auto& table = reinterpret_cast<const CR2W*>(data.data())->tables[t];
+        std::vector<T> out(table.count);
+        if (table.count)
+            memcpy(out.data(), data.data() + table.pos, out.size() * sizeof(T));
+        return out;
+    }
+
+    std::vector<CR2WIndexArchive> archives;
+    std::string names;
+    std::unordered_map<std::string, uint32_t> interned;
+    std::vector<std::string> values;
+    std::vector<Posting> postings;
+    uint64_t cr2w_files = 0;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+
+#if defined(__linux__) && __has_include(<linux/fs.h>)
+#define ARCHIVEDUMP_REFLINK 1
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+// --------------------
+// Content addressed store for entries that ship more than once. The blob of SHA-1 h lives in
+// root/h[0..2]/h[2..40]/ as "data", plus "buf_<n>" for the CR2W buffers unpacked from it.
+// Outputs are placed with a reflink where the file system has them (copy on write, so the
+// copies stay independent), a hard link otherwise, and a plain copy as the last resort.
+// Not thread safe.
+class ContentStore {
+public:
+    enum Placement { kReflink, kHardLink, kCopy, kFailed, kPlacementCount };
+
+    static std::string Hex(const uint8_t* hash)
+    {
+        char hex[41];
+        for (int k = 0; k < 20; k++)
+            snprintf(hex + k * 2, 3, "%02x", hash[k]);
+        return hex;
+    }
+
+    // blobs of earlier runs are picked up from the directory listing
+    void Open(const std::filesystem::path& root)
+    {
+        this->root = root;
+        blobs.clear();
+        std::error_code ec;
+        for (auto& fan : std::filesystem::directory_iterator(root, ec))
+        {
+            auto prefix = fan.path().filename().string();
+            if (prefix.size() != 2 || !fan.is_directory())
+                continue;
+            for (auto& blob : std::filesystem::directory_iterator(fan.path(), ec))
+                if (blob.is_directory())
+                    blobs.insert(prefix + blob.path().filename().string());
+        }
+    }
+
+    bool Has(const std::string& hex) const { return blobs.count(hex) != 0; }
+    size_t Size() const { return blobs.size(); }
+
+    // take an output file and its buffers <file>_buf_<n>, n < buffers, in as the blob of hex
+    bool Adopt(const std::string& hex, const std::filesystem::path& file, uint32_t buffers)
+    {
+        auto dir = BlobDir(hex);
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (Link(file, dir / "data") == kFailed)
+            return false;
+        for (uint32_t n = 0; n < buffers; n++)
+        {
+            auto buf = file;
+            buf += "_buf_" + std::to_string(n);
+            if (std::filesystem::exists(buf, ec))
+                Link(buf, dir / ("buf_" + std::to_string(n)));
+        }
+        blobs.insert(hex);
+        return true;
+    }
+
+    // Put the blob of hex at file, its buffers next to it. Returns how the data file got there;
+    // buffers is set to one past the highest buffer index placed.
+    Placement Place(const std::string& hex, const std::filesystem::path& file, uint32_t* buffers)
+    {
+        auto dir = BlobDir(hex);
+        Placement result = Link(dir / "data", file);
+        uint32_t count = 0;
+        std::error_code ec;
+        for (auto& e : std::filesystem::directory_iterator(dir, ec))
+        {
+            auto name = e.path().filename().string();
+            if (name.compare(0, 4, "buf_") != 0)
+                continue;
+            uint32_t n = uint32_t(strtoul(name.c_str() + 4, nullptr, 10));
+            auto buf = file;
+            buf += "_buf_" + std::to_string(n);
+            Link(e.path(), buf);
+            count = (std::max)(count, n + 1);
+        }
+        *buffers = count;
+        return result;
+    }
+
+private:
+    std::filesystem::path BlobDir(const std::string& hex) const { return root / hex.substr(0, 2) / hex.substr(2); }
+
+    static Placement Link(const std::filesystem::path& from, const std::filesystem::path& to)
+    {
+        std::error_code ec;
+        std::filesystem::remove(to, ec);
+#ifdef ARCHIVEDUMP_REFLINK
+        if (Reflink(from, to))
+            return kReflink;
+#endif
+        ec.clear();
+        std::filesystem::create_hard_link(from, to, ec);
+        if (!ec)
+            return kHardLink;
+        ec.clear();
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+        return ec ? kFailed : kCopy;
+    }
+
+#ifdef ARCHIVEDUMP_REFLINK
+    static bool Reflink(const std::filesystem::path& from, const std::filesystem::path& to)
+    {
+        int src = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (src < 0)
+            return false;
+        int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool ok = dst >= 0 && ioctl(dst, FICLONE, src) == 0;
+        if (dst >= 0)
+        {
+            close(dst);
+            if (!ok)
+                unlink(to.c_str());
+        }
+        close(src);
+        return ok;
+    }
+#endif
+
+    std::filesystem::path root;
+    std::unordered_set<std::string> blobs;
+};
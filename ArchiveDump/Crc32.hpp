@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ARCHIVEDUMP_CRC32_CLMUL 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ARCHIVEDUMP_CRC32_TARGET
+#else
+#include <cpuid.h>
+#define ARCHIVEDUMP_CRC32_TARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+#endif
+
+// --------------------
+// CRC-32 as in zlib / CR2W (reflected 0xEDB88320). Runs of 64 bytes and more are folded
+// with PCLMULQDQ (the constants and reduction of Intel's "Fast CRC Computation Using
+// PCLMULQDQ", as used by Chromium's zlib); short runs and the tail use slicing-by-8.
+// SSE4.2's crc32 instruction computes CRC-32C, a different polynomial, so it is no use here.
+class Crc32 {
+public:
+    static uint32_t Compute(const void* data, size_t size, uint32_t crc = 0)
+    {
+        auto p = reinterpret_cast<const unsigned char*>(data);
+        uint32_t c = ~crc;
+#ifdef ARCHIVEDUMP_CRC32_CLMUL
+        if (size >= 64 && HasClmul())
+        {
+            size_t chunk = size & ~size_t(15);
+            c = FoldClmul(p, chunk, c);
+            p += chunk;
+            size -= chunk;
+        }
+#endif
+        return ~Slice8(p, size, c);
+    }
+
+    static const char* Backend()
+    {
+#ifdef ARCHIVEDUMP_CRC32_CLMUL
+        if (HasClmul())
+            return "pclmul";
+#endif
+        return "slice-by-8";
+    }
+
+private:
+    struct Tables {
+        uint32_t t[8][256];
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c >> 1) ^ ((c & 1) ? 0xEDB88320u : 0);
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; i++)
+                for (int s = 1; s < 8; s++)
+                    t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+        }
+    };
+
+    static const Tables& Table()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    // c is the pre-inverted register value
+    static uint32_t Slice8(const unsigned char* p, size_t size, uint32_t c)
+    {
+        auto& t = Table().t;
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint32_t lo = c ^ (uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24));
+            uint32_t hi = uint32_t(p[4]) | (uint32_t(p[5]) << 8) | (uint32_t(p[6]) << 16) | (uint32_t(p[7]) << 24);
+            c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (; size > 0; size--, p++)
+            c = (c >> 8) ^ t[0][(c ^ *p) & 0xFF];
+        return c;
+    }
+
+#ifdef ARCHIVEDUMP_CRC32_CLMUL
+    static bool HasClmul()
+    {
+        static const bool has = [] {
+#ifdef _MSC_VER
+            int r[4];
+            __cpuid(r, 1);
+            uint32_t ecx = uint32_t(r[2]);
+#else
+            unsigned int a, b, ecx = 0, d;
+            __get_cpuid(1, &a, &b, &ecx, &d);
+#endif
+            return (ecx & (1u << 1)) && (ecx & (1u << 19));   // pclmulqdq, sse4.1
+        }();
+        return has;
+    }
+
+    static __m128i Load(const unsigned char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+
+    ARCHIVEDUMP_CRC32_TARGET
+    static inline __m128i Fold16(__m128i x, __m128i k, __m128i next)
+    {
+        __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+        __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+        return _mm_xor_si128(_mm_xor_si128(hi, next), lo);
+    }
+
+    // size >= 64 and a multiple of 16, c is the pre-inverted register value
+    ARCHIVEDUMP_CRC32_TARGET
+    static uint32_t FoldClmul(const unsigned char* buf, size_t size, uint32_t c)
+    {
+        alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+        alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+        alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+        alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+        x1 = _mm_xor_si128(Load(buf + 0x00), _mm_cvtsi32_si128(int(c)));
+        x2 = Load(buf + 0x10);
+        x3 = Load(buf + 0x20);
+        x4 = Load(buf + 0x30);
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+        buf += 64;
+        size -= 64;
+
+        // four lanes of 128 bits folded 64 bytes at a time
+        for (; size >= 64; buf += 64, size -= 64)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), Load(buf + 0x00));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), Load(buf + 0x10));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), Load(buf + 0x20));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), Load(buf + 0x30));
+        }
+
+        // fold the four lanes into one
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+        x1 = Fold16(x1, x0, x2);
+        x1 = Fold16(x1, x0, x3);
+        x1 = Fold16(x1, x0, x4);
+        for (; size >= 16; buf += 16, size -= 16)
+            x1 = Fold16(x1, x0, Load(buf));
+
+        // 128 -> 64 bits
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction to 32 bits
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        return uint32_t(_mm_extract_epi32(x1, 1));
+    }
+#endif
+};
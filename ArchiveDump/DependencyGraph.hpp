@@ -0,0 +1,171 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "ThreadPool.hpp"
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// --------------------
+// resourceDependencies of a set of archives as one compressed sparse row graph. Node n is
+// entry n - archiveBase[a] of archive a; edges of n are targets[offsets[n], offsets[n + 1]).
+// A dependency id resolves to the first archive, in the order given to Build, that has it.
+// Ids no loaded archive has are dropped and counted in Unresolved().
+class DependencyGraph {
+public:
+    static constexpr uint32_t kNoNode = UINT32_MAX;
+
+    void Build(std::span<RedArchive* const> archives)
+    {
+        this->archives.assign(archives.begin(), archives.end());
+        archive_base.assign(1, 0);
+        for (auto archive : archives)
+            archive_base.push_back(archive_base.back() + archive->fileTable->fileEntryCount);
+
+        BuildIdTable();
+
+        offsets.assign(1, 0);
+        targets.clear();
+        unresolved = 0;
+        for (auto archive : archives)
+        {
+            auto deps = std::span<const uint64_t>(reinterpret_cast<const uint64_t*>(archive->dependency), archive->fileTable->resourceDependencyCount);
+            for (uint32_t i = 0; i < archive->fileTable->fileEntryCount; i++)
+            {
+                auto& fentry = archive->entry[i];
+                for (uint32_t dep_index = fentry.resourceDependenciesStart; dep_index < fentry.resourceDependenciesEnd && dep_index < deps.size(); dep_index++)
+                {
+                    uint32_t node = Find(deps[dep_index]);
+                    if (node != kNoNode)
+                        targets.push_back(node);
+                    else
+                        unresolved++;
+                }
+                offsets.push_back(uint32_t(targets.size()));
+            }
+        }
+    }
+
+    uint32_t NodeCount() const { return archive_base.back(); }
+    uint64_t EdgeCount() const { return targets.size(); }
+    uint64_t Unresolved() const { return unresolved; }
+
+    uint32_t Node(uint32_t archive, uint32_t file_index) const { return archive_base[archive] + file_index; }
+
+    // archive index and entry index of a node
+    std::pair<uint32_t, uint32_t> Locate(uint32_t node) const
+    {
+        uint32_t a = uint32_t(std::upper_bound(archive_base.begin(), archive_base.end(), node) - archive_base.begin()) - 1;
+        return { a, node - archive_base[a] };
+    }
+
+    // node of a resource id, kNoNode if no archive has it
+    uint32_t Find(uint64_t id) const
+    {
+        for (uint64_t slot = IdSlot(id);; slot = (slot + 1) & id_mask)
+        {
+            const IdSlotEntry& s = id_table[slot];
+            if (s.node == kNoNode || s.id == id)
+                return s.node;
+        }
+    }
+
+    // Every node reachable from roots, roots included. Level synchronous BFS: each frontier
+    // is cut into chunks that run on pool, a node is claimed by whichever chunk flips its
+    // visited flag first. Small frontiers are expanded inline.
+    std::vector<uint32_t> Closure(std::span<const uint32_t> roots, ThreadPool* pool = nullptr) const
+    {
+        auto visited = std::make_unique<std::atomic<uint8_t>[]>(NodeCount());
+        std::vector<uint32_t> closure;
+        std::vector<uint32_t> frontier;
+        for (auto root : roots)
+        {
+            if (root < NodeCount() && !visited[root].exchange(1))
+                frontier.push_back(root);
+        }
+
+        constexpr size_t kChunk = 1024;
+        std::mutex next_lock;
+        while (!frontier.empty())
+        {
+            closure.insert(closure.end(), frontier.begin(), frontier.end());
+            std::vector<uint32_t> next;
+            auto expand = [&](size_t begin, size_t end) {
+                std::vector<uint32_t> local;
+                for (size_t k = begin; k < end; k++)
+                {
+                    uint32_t n = frontier[k];
+                    for (uint32_t e = offsets[n]; e < offsets[n + 1]; e++)
+                    {
+                        uint32_t t = targets[e];
+                        if (!visited[t].load(std::memory_order_relaxed) && !visited[t].exchange(1))
+                            local.push_back(t);
+                    }
+                }
+                std::lock_guard<std::mutex> l(next_lock);
+                next.insert(next.end(), local.begin(), local.end());
+            };
+
+            if (!pool || frontier.size() <= kChunk)
+                expand(0, frontier.size());
+            else
+            {
+                for (size_t begin = 0; begin < frontier.size(); begin += kChunk)
+                    pool->Submit([&, begin] { expand(begin, (std::min)(begin + kChunk, frontier.size())); });
+                pool->Wait();
+            }
+            frontier.swap(next);
+        }
+        std::sort(closure.begin(), closure.end());
+        return closure;
+    }
+
+private:
+    struct IdSlotEntry {
+        uint64_t id;
+        uint32_t node;
+    };
+
+    // one open addressing table over the ids of all archives, built once, so every
+    // dependency resolves with a single probe sequence whatever the number of archives
+    void BuildIdTable()
+    {
+        uint64_t capacity = 16;
+        while (capacity < uint64_t(NodeCount()) * 2)
+            capacity <<= 1;
+        id_mask = capacity - 1;
+        id_shift = 64;
+        for (uint64_t c = capacity; c > 1; c >>= 1)
+            id_shift--;
+        id_table.assign(capacity, IdSlotEntry{ 0, kNoNode });
+        for (uint32_t a = 0; a < archives.size(); a++)
+        {
+            for (uint32_t i = 0; i < archives[a]->fileTable->fileEntryCount; i++)
+            {
+                uint64_t id = archives[a]->entry[i].id;
+                uint64_t slot = IdSlot(id);
+                // the first archive, and within it the first entry, keeps the id
+                while (id_table[slot].node != kNoNode && id_table[slot].id != id)
+                    slot = (slot + 1) & id_mask;
+                if (id_table[slot].node == kNoNode)
+                    id_table[slot] = { id, archive_base[a] + i };
+            }
+        }
+    }
+
+    uint64_t IdSlot(uint64_t id) const { return (id * 0x9E3779B97F4A7C15ull) >> id_shift; }
+
+    std::vector<RedArchive*> archives;
+    std::vector<uint32_t> archive_base;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> targets;
+    uint64_t unresolved = 0;
+    std::vector<IdSlotEntry> id_table;
+    uint64_t id_mask = 0;
+    uint32_t id_shift = 64;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "MappedArchiveFile.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ---- On-disk resource index over a directory of archives ----
+//
+// header | archives[archiveCount] | entries[entryCount] | byId[entryCount] | names
+//
+// Entries are grouped per archive in file table order, byId holds entry numbers sorted by
+// id. Everything is plain data so the file is used straight from its mapping.
+
+#pragma pack(push, GIDX, 1)
+struct GlobalIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t archiveCount;
+    uint32_t entryCount;
+    uint64_t namesSize;
+};
+
+struct GlobalIndexArchive {
+    // 0x20
+    uint64_t fileSize;      // stamp: archive file size
+    uint64_t crc64;         // stamp: RedArchiveFileTable::crc64
+    uint32_t firstEntry;
+    uint32_t entryCount;
+    uint32_t nameOffset;    // file name relative to the indexed directory
+    uint32_t nameLength;
+};
+
+struct GlobalIndexEntry {
+    // 0x48
+    uint64_t id;
+    uint64_t timestamp;
+    uint32_t archive;
+    uint32_t entryIndex;
+    uint32_t segmentsStart;
+    uint32_t segmentsEnd;
+    uint64_t sizeOnDisk;
+    uint64_t sizeInMemory;
+    uint8_t  hash[20];  // SHA-1
+    uint32_t reserved;
+};
+#pragma pack(pop, GIDX)
+
+static constexpr uint32_t kGlobalIndexMagic = 'GIDX';
+static constexpr uint32_t kGlobalIndexVersion = 2;
+
+// --------------------
+// Read side, a mapped index file.
+class GlobalIndex {
+public:
+    bool Open(const std::filesystem::path& path)
+    {
+        Close();
+        if (!file.Open(path))
+            return false;
+        auto base = reinterpret_cast<const unsigned char*>(file.Data());
+        uint64_t size = file.Size();
+        if (size < sizeof(GlobalIndexHeader))
+            return Fail();
+        header = reinterpret_cast<const GlobalIndexHeader*>(base);
+        if (header->magic != kGlobalIndexMagic || header->version != kGlobalIndexVersion)
+            return Fail();
+        uint64_t expected = sizeof(GlobalIndexHeader) + uint64_t(header->archiveCount) * sizeof(GlobalIndexArchive)
+            + uint64_t(header->entryCount) * (sizeof(GlobalIndexEntry) + sizeof(uint32_t)) + header->namesSize;
+        if (size != expected)
+            return Fail();
+        archives = reinterpret_cast<const GlobalIndexArchive*>(header + 1);
+        entries = reinterpret_cast<const GlobalIndexEntry*>(archives + header->archiveCount);
+        by_id = reinterpret_cast<const uint32_t*>(entries + header->entryCount);
+        names = reinterpret_cast<const char*>(by_id + header->entryCount);
+        // a stale or damaged file is rejected as a whole, the caller rebuilds it
+        for (uint32_t i = 0; i < header->archiveCount; i++)
+        {
+            auto& a = archives[i];
+            if (uint64_t(a.firstEntry) + a.entryCount > header->entryCount || uint64_t(a.nameOffset) + a.nameLength > header->namesSize)
+                return Fail();
+        }
+        for (uint32_t k = 0; k < header->entryCount; k++)
+            if (entries[k].archive >= header->archiveCount || by_id[k] >= header->entryCount
+                || (k > 0 && entries[by_id[k]].id < entries[by_id[k - 1]].id))
+                return Fail();
+        return true;
+    }
+
+    void Close()
+    {
+        file.Close();
+        header = nullptr;
+        archives = nullptr;
+        entries = nullptr;
+        by_id = nullptr;
+        names = nullptr;
+    }
+
+    bool IsOpen() const { return header != nullptr; }
+
+    uint32_t ArchiveCount() const { return header ? header->archiveCount : 0; }
+    uint32_t EntryCount() const { return header ? header->entryCount : 0; }
+    const GlobalIndexArchive& Archive(uint32_t i) const { return archives[i]; }
+    std::string_view ArchiveName(uint32_t i) const { return { names + archives[i].nameOffset, archives[i].nameLength }; }
+
+    std::span<const GlobalIndexEntry> Entries(uint32_t archive) const
+    {
+        return { entries + archives[archive].firstEntry, archives[archive].entryCount };
+    }
+
+    // archive recorded under this name, UINT32_MAX if there is none
+    uint32_t FindArchive(std::string_view name) const
+    {
+        for (uint32_t i = 0; i < ArchiveCount(); i++)
+            if (ArchiveName(i) == name)
+                return i;
+        return UINT32_MAX;
+    }
+
+    // first entry with this id in archive order, nullptr if no archive has it
+    const GlobalIndexEntry* Find(uint64_t id) const
+    {
+        if (!header)
+            return nullptr;
+        const uint32_t* first = by_id;
+        const uint32_t* last = by_id + header->entryCount;
+        auto it = std::lower_bound(first, last, id, [this](uint32_t e, uint64_t v) { return entries[e].id < v; });
+        if (it == last || entries[*it].id != id)
+            return nullptr;
+        return &entries[*it];
+    }
+
+private:
+    bool Fail()
+    {
+        Close();
+        return false;
+    }
+
+    MappedArchiveFile file;
+    const GlobalIndexHeader* header = nullptr;
+    const GlobalIndexArchive* archives = nullptr;
+    const GlobalIndexEntry* entries = nullptr;
+    const uint32_t* by_id = nullptr;
+    const char* names = nullptr;
+};
+
+// --------------------
+// Write side. Unchanged archives are copied over from the previous index, changed ones
+// are rescanned from their RedArchive.
+class GlobalIndexBuilder {
+public:
+    void AddArchive(const std::string& name, uint64_t file_size, RedArchive& archive)
+    {
+        uint32_t first = uint32_t(entries.size());
+        uint32_t count = archive.fileTable->fileEntryCount;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            auto& fentry = archive.entry[i];
+            GlobalIndexEntry e{};
+            e.id = fentry.id;
+            e.timestamp = fentry.timestamp;
+            e.archive = uint32_t(archives.size());
+            e.entryIndex = i;
+            e.segmentsStart = fentry.segmentsStart;
+            e.segmentsEnd = fentry.segmentsEnd;
+            for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+            {
+                e.sizeOnDisk += archive.segment[seg_index].sizeOnDisk;
+                e.sizeInMemory += archive.segment[seg_index].sizeInMemory;
+            }
+            memcpy(e.hash, fentry.hash, sizeof(e.hash));
+            entries.push_back(e);
+        }
+        PushArchive(name, file_size, archive.fileTable->crc64, first, count);
+    }
+
+    void CopyArchive(const GlobalIndex& index, uint32_t archive)
+    {
+        uint32_t first = uint32_t(entries.size());
+        for (auto e : index.Entries(archive))
+        {
+            e.archive = uint32_t(archives.size());
+            entries.push_back(e);
+        }
+        auto& a = index.Archive(archive);
+        PushArchive(std::string(index.ArchiveName(archive)), a.fileSize, a.crc64, first, a.entryCount);
+    }
+
+    // written next to the target and renamed over it, readers never see a partial file
+    bool Save(const std::filesystem::path& path)
+    {
+        std::vector<uint32_t> by_id(entries.size());
+        for (uint32_t i = 0; i < by_id.size(); i++)
+            by_id[i] = i;
+        std::stable_sort(by_id.begin(), by_id.end(), [this](uint32_t a, uint32_t b) { return entries[a].id < entries[b].id; });
+
+        GlobalIndexHeader header{ kGlobalIndexMagic, kGlobalIndexVersion, uint32_t(archives.size()), uint32_t(entries.size()), names.size() };
+        auto tmp_path = path;
+        tmp_path += ".tmp";
+        {
+            std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(archives.data()), archives.size() * sizeof(GlobalIndexArchive));
+            ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(GlobalIndexEntry));
+            ofs.write(reinterpret_cast<const char*>(by_id.data()), by_id.size() * sizeof(uint32_t));
+            ofs.write(names.data(), names.size());
+            if (!ofs)
+                return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path, ec);
+        return !ec;
+    }
+
+    uint32_t ArchiveCount() const { return uint32_t(archives.size()); }
+    uint32_t EntryCount() const { return uint32_t(entries.size()); }
+
+private:
+    void PushArchive(const std::string& name, uint64_t file_size, uint64_t crc64, uint32_t first, uint32_t count)
+    {
+        archives.push_back({ file_size, crc64, first, count, uint32_t(names.size()), uint32_t(name.size()) });
+        names += name;
+    }
+
+    std::vector<GlobalIndexArchive> archives;
+    std::vector<GlobalIndexEntry> entries;
+    std::string names;
+};
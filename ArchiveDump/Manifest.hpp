@@ -0,0 +1,158 @@
+#pragma once
+
+#include "RADR.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+// --------------------
+// What one dump directory holds, one line per written entry:
+//
+//   id sha1 timestamp sizeOnDisk sizeInMemory buffers name
+//
+// All fields but the last two come from the entry and segment tables, so an archive is
+// compared against a manifest without touching any entry data. name is relative to the dump
+// directory with '/' separators; CR2W buffers written next to it as <name>_buf_<n> have
+// n < buffers.
+struct ManifestRecord {
+    uint64_t id = 0;
+    uint8_t  hash[20] = {};
+    uint64_t timestamp = 0;
+    uint64_t sizeOnDisk = 0;
+    uint64_t sizeInMemory = 0;
+    uint32_t buffers = 0;
+    std::string name;   // empty = not written
+
+    static ManifestRecord FromEntry(RedArchive& archive, uint32_t file_index)
+    {
+        auto& fentry = archive.entry[file_index];
+        ManifestRecord r;
+        r.id = fentry.id;
+        memcpy(r.hash, fentry.hash, sizeof(r.hash));
+        r.timestamp = fentry.timestamp;
+        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+        {
+            r.sizeOnDisk += archive.segment[seg_index].sizeOnDisk;
+            r.sizeInMemory += archive.segment[seg_index].sizeInMemory;
+        }
+        return r;
+    }
+
+    // same resource contents, wherever they were written
+    bool SameContent(const ManifestRecord& other) const
+    {
+        return id == other.id && memcmp(hash, other.hash, sizeof(hash)) == 0 && timestamp == other.timestamp
+            && sizeOnDisk == other.sizeOnDisk && sizeInMemory == other.sizeInMemory;
+    }
+
+    // every file this record stands for, relative to the dump directory
+    std::vector<std::filesystem::path> Outputs() const
+    {
+        std::vector<std::filesystem::path> files;
+        files.emplace_back(name);
+        for (uint32_t n = 0; n < buffers; n++)
+            files.emplace_back(name + "_buf_" + std::to_string(n));
+        return files;
+    }
+};
+
+class Manifest {
+public:
+    static constexpr const char* kFileName = "ArchiveDump.manifest";
+
+    // false if there is no readable manifest; lines that do not parse are skipped
+    bool Load(const std::filesystem::path& file)
+    {
+        records.clear();
+        by_id.clear();
+        std::ifstream ifs(file, std::ios::binary);
+        if (!ifs)
+            return false;
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty() || line[0] == '#')
+                continue;
+            ManifestRecord r;
+            unsigned long long id, timestamp, disk, mem;
+            char hex[41];
+            int name_start = 0;
+            if (sscanf(line.c_str(), "%llu %40s %llu %llu %llu %u %n", &id, hex, &timestamp, &disk, &mem, &r.buffers, &name_start) != 6
+                || name_start == 0 || size_t(name_start) >= line.size() || !ParseHash(hex, r.hash))
+                continue;
+            r.id = id;
+            r.timestamp = timestamp;
+            r.sizeOnDisk = disk;
+            r.sizeInMemory = mem;
+            r.name = line.substr(name_start);
+            by_id[r.id] = uint32_t(records.size());
+            records.push_back(std::move(r));
+        }
+        return true;
+    }
+
+    // records without a name are left out. Written to a temporary file first so an
+    // interrupted run keeps the previous manifest.
+    static bool Save(const std::filesystem::path& file, std::span<const ManifestRecord> records)
+    {
+        auto tmp = file;
+        tmp += ".tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+            ofs << "# id sha1 timestamp sizeOnDisk sizeInMemory buffers name\n";
+            char line[160];
+            for (auto&& r : records)
+            {
+                if (r.name.empty())
+                    continue;
+                char hex[41];
+                for (int k = 0; k < 20; k++)
+                    snprintf(hex + k * 2, 3, "%02x", r.hash[k]);
+                snprintf(line, sizeof(line), "%llu %s %llu %llu %llu %u ", (unsigned long long)r.id, hex,
+                    (unsigned long long)r.timestamp, (unsigned long long)r.sizeOnDisk, (unsigned long long)r.sizeInMemory, r.buffers);
+                ofs << line << r.name << '\n';
+            }
+            if (!ofs)
+                return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, file, ec);
+        return !ec;
+    }
+
+    const ManifestRecord* Find(uint64_t id) const
+    {
+        auto it = by_id.find(id);
+        return it == by_id.end() ? nullptr : &records[it->second];
+    }
+
+    std::span<const ManifestRecord> Records() const { return records; }
+
+private:
+    static bool ParseHash(const char* hex, uint8_t* out)
+    {
+        if (strlen(hex) != 40)
+            return false;
+        for (int k = 0; k < 20; k++)
+        {
+            unsigned v;
+            if (sscanf(hex + k * 2, "%2x", &v) != 1)
+                return false;
+            out[k] = uint8_t(v);
+        }
+        return true;
+    }
+
+    std::vector<ManifestRecord> records;
+    std::unordered_map<uint64_t, uint32_t> by_id;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// --------------------
+// Read-only mapping of a whole file: CreateFileMapping/MapViewOfFile on Windows, mmap elsewhere.
+// The Advise* hints map to madvise on POSIX and PrefetchVirtualMemory on Windows, and are
+// no-ops where the platform has nothing equivalent.
+class MappedArchiveFile {
+public:
+    struct Options {
+        bool sequential = false;    // the whole file is read front to back, once
+        bool hugePages = false;     // ask for transparent huge pages (Linux)
+    };
+
+    MappedArchiveFile() = default;
+    ~MappedArchiveFile() { Close(); }
+
+    MappedArchiveFile(const MappedArchiveFile&) = delete;
+    MappedArchiveFile& operator=(const MappedArchiveFile&) = delete;
+
+    bool Open(const std::filesystem::path& path) { return Open(path, Options()); }
+
+    bool Open(const std::filesystem::path& path, const Options& options)
+    {
+        Close();
+#ifdef _WIN32
+        file_handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | (options.sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0), 0);
+        if (file_handle == INVALID_HANDLE_VALUE)
+            return Fail("open file", GetLastError());
+        LARGE_INTEGER filesize;
+        if (!GetFileSizeEx(file_handle, &filesize))
+            return Fail("get file size", GetLastError());
+        size = uint64_t(filesize.QuadPart);
+        map_handle = CreateFileMappingW(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map_handle == NULL)
+            return Fail("create file mapping object", GetLastError());
+        data = MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, size);
+        if (data == NULL)
+            return Fail("map view of file", GetLastError());
+#else
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return Fail("open file", errno);
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            return Fail("get file size", errno);
+        size = uint64_t(st.st_size);
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            data = nullptr;
+            return Fail("map file", errno);
+        }
+#ifdef MADV_HUGEPAGE
+        // file-backed THP needs CONFIG_READ_ONLY_THP_FOR_FS, failure is harmless
+        if (options.hugePages)
+            madvise(data, size, MADV_HUGEPAGE);
+#endif
+        if (options.sequential)
+            madvise(data, size, MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (map_handle)
+            CloseHandle(map_handle);
+        if (file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+        map_handle = NULL;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap(data, size);
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    // range will be read front to back
+    void AdviseSequential(uint64_t offset, uint64_t length)
+    {
+#ifndef _WIN32
+        Advise(offset, length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    // range will be needed soon, start reading it in now
+    void AdviseWillNeed(uint64_t offset, uint64_t length)
+    {
+#ifdef _WIN32
+        if (!Clamp(offset, length))
+            return;
+        WIN32_MEMORY_RANGE_ENTRY range{ Get(offset), SIZE_T(length) };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        Advise(offset, length, MADV_WILLNEED);
+#endif
+    }
+
+    void* Data() const { return data; }
+    uint64_t Size() const { return size; }
+    bool IsOpen() const { return data != nullptr; }
+
+    // what failed and the errno / GetLastError() value
+    const char* ErrorStage() const { return error_stage; }
+    int ErrorCode() const { return error_code; }
+
+private:
+    void* Get(uint64_t offset) const { return reinterpret_cast<unsigned char*>(data) + offset; }
+
+    bool Clamp(uint64_t& offset, uint64_t& length) const
+    {
+        if (!data || offset >= size)
+            return false;
+        length = (std::min)(length, size - offset);
+        return length > 0;
+    }
+
+#ifndef _WIN32
+    void Advise(uint64_t offset, uint64_t length, int advice)
+    {
+        if (!Clamp(offset, length))
+            return;
+        // madvise wants a page aligned start
+        const uint64_t page = uint64_t(sysconf(_SC_PAGESIZE));
+        uint64_t aligned = offset & ~(page - 1);
+        madvise(Get(aligned), length + (offset - aligned), advice);
+    }
+#endif
+
+    bool Fail(const char* stage, int code)
+    {
+        error_stage = stage;
+        error_code = code;
+        Close();
+        return false;
+    }
+
+    void* data = nullptr;
+    uint64_t size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE map_handle = NULL;
+#else
+    int fd = -1;
+#endif
+    const char* error_stage = "";
+    int error_code = 0;
+};
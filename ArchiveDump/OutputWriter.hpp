@@ -0,0 +1,719 @@
+#pragma once
+
+#include "Telemetry.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ARCHIVEDUMP_IO_URING 1
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// --------------------
+// One file to be written. data stays valid as long as owner is alive, or for the lifetime
+// of the mapping when it points into an archive.
+struct OutputJob {
+    std::filesystem::path path;
+    const unsigned char* data = nullptr;
+    uint64_t size = 0;
+    std::shared_ptr<const void> owner;
+};
+
+// --------------------
+// POSIX tar written front to back into one file: ustar headers, with pax records for names of
+// 100 bytes and more and for members past 8 GiB. Everything goes out in kChunk sized writes at
+// chunk aligned offsets, so the file system sees one large sequential stream. No directory
+// members are written, tar creates parents when extracting.
+class TarStream {
+public:
+    static constexpr size_t kBlock = 512;
+    static constexpr size_t kChunk = size_t(8) << 20;
+
+    bool Open(const std::filesystem::path& path)
+    {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        staging.resize(kChunk);
+        mtime = uint64_t(time(nullptr));
+        return bool(file);
+    }
+
+    bool Add(const std::string& name, const unsigned char* data, uint64_t size)
+    {
+        std::string pax;
+        if (name.size() >= sizeof(Header::name))
+            pax += PaxRecord("path", name);
+        if (size > kMaxUstarSize)
+            pax += PaxRecord("size", std::to_string(size));
+        if (!pax.empty())
+        {
+            Header h = MakeHeader("././@PaxHeader", pax.size(), 'x');
+            Append(&h, sizeof(h));
+            Append(pax.data(), pax.size());
+            Pad(pax.size());
+        }
+        Header h = MakeHeader(name, size, '0');
+        Append(&h, sizeof(h));
+        Append(data, size);
+        Pad(size);
+        return bool(file);
+    }
+
+    // end of archive marker, then whatever is still staged
+    bool Close()
+    {
+        static const unsigned char zero[kBlock * 2] = {};
+        Append(zero, sizeof(zero));
+        if (used)
+            file.write(reinterpret_cast<const char*>(staging.data()), std::streamsize(used));
+        used = 0;
+        file.close();
+        return !file.fail();
+    }
+
+private:
+    struct Header {
+        char name[100];
+        char mode[8];
+        char uid[8];
+        char gid[8];
+        char size[12];
+        char mtime[12];
+        char chksum[8];
+        char typeflag;
+        char linkname[100];
+        char magic[6];
+        char version[2];
+        char uname[32];
+        char gname[32];
+        char devmajor[8];
+        char devminor[8];
+        char prefix[155];
+        char pad[12];
+    };
+    static_assert(sizeof(Header) == kBlock);
+
+    static constexpr uint64_t kMaxUstarSize = (uint64_t(1) << 33) - 1;    // 11 octal digits
+
+    template<size_t N>
+    static void Octal(char (&field)[N], uint64_t value)
+    {
+        snprintf(field, N, "%0*llo", int(N - 1), (unsigned long long)value);
+    }
+
+    // "<length> key=value\n", the length counting its own digits
+    static std::string PaxRecord(const char* key, const std::string& value)
+    {
+        size_t body = 1 + strlen(key) + 1 + value.size() + 1;
+        size_t length = body + 1;
+        while (std::to_string(length).size() + body != length)
+            length++;
+        return std::to_string(length) + " " + key + "=" + value + "\n";
+    }
+
+    Header MakeHeader(const std::string& name, uint64_t size, char type) const
+    {
+        Header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.name, name.data(), (std::min)(name.size(), sizeof(h.name)));
+        Octal(h.mode, 0644);
+        Octal(h.uid, 0);
+        Octal(h.gid, 0);
+        Octal(h.size, (std::min)(size, kMaxUstarSize));
+        Octal(h.mtime, mtime);
+        h.typeflag = type;
+        memcpy(h.magic, "ustar", 6);
+        memcpy(h.version, "00", 2);
+        memset(h.chksum, ' ', sizeof(h.chksum));
+        uint32_t sum = 0;
+        for (size_t i = 0; i < sizeof(h); i++)
+            sum += reinterpret_cast<const unsigned char*>(&h)[i];
+        snprintf(h.chksum, sizeof(h.chksum), "%06o", sum);
+        return h;
+    }
+
+    void Append(const void* src, uint64_t size)
+    {
+        auto p = static_cast<const unsigned char*>(src);
+        while (size)
+        {
+            // whole chunks are written straight from the source
+            if (used == 0 && size >= kChunk)
+            {
+                uint64_t direct = size - size % kChunk;
+                file.write(reinterpret_cast<const char*>(p), std::streamsize(direct));
+                p += direct;
+                size -= direct;
+                continue;
+            }
+            size_t n = size_t((std::min)(uint64_t(kChunk - used), size));
+            memcpy(staging.data() + used, p, n);
+            used += n;
+            p += n;
+            size -= n;
+            if (used == kChunk)
+            {
+                file.write(reinterpret_cast<const char*>(staging.data()), std::streamsize(kChunk));
+                used = 0;
+            }
+        }
+    }
+
+    void Pad(uint64_t size)
+    {
+        static const unsigned char zero[kBlock] = {};
+        Append(zero, (kBlock - size % kBlock) % kBlock);
+    }
+
+    std::ofstream file;
+    std::vector<unsigned char> staging;
+    size_t used = 0;
+    uint64_t mtime = 0;
+};
+
+#ifdef ARCHIVEDUMP_IO_URING
+// --------------------
+// Bare io_uring over the raw syscalls, just enough for the output stage.
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring()
+    {
+        if (sqes)
+            munmap(sqes, sqes_size);
+        if (cq_ring && cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        if (sq_ring)
+            munmap(sq_ring, sq_ring_size);
+        if (ring_fd >= 0)
+            close(ring_fd);
+    }
+
+    bool Init(uint32_t entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ring_fd = int(syscall(__NR_io_uring_setup, entries, &p));
+        if (ring_fd < 0)
+            return false;
+
+        sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_ring_size = cq_ring_size = (std::max)(sq_ring_size, cq_ring_size);
+
+        sq_ring = Map(sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : Map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = reinterpret_cast<io_uring_sqe*>(Map(sqes_size, IORING_OFF_SQES));
+        if (!sq_ring || !cq_ring || !sqes)
+            return false;
+
+        sq_head = Field<uint32_t>(sq_ring, p.sq_off.head);
+        sq_tail = Field<uint32_t>(sq_ring, p.sq_off.tail);
+        sq_mask = *Field<uint32_t>(sq_ring, p.sq_off.ring_mask);
+        sq_array = Field<uint32_t>(sq_ring, p.sq_off.array);
+        cq_head = Field<uint32_t>(cq_ring, p.cq_off.head);
+        cq_tail = Field<uint32_t>(cq_ring, p.cq_off.tail);
+        cq_mask = *Field<uint32_t>(cq_ring, p.cq_off.ring_mask);
+        cqes = Field<io_uring_cqe>(cq_ring, p.cq_off.cqes);
+        sq_entries = p.sq_entries;
+        local_tail = *sq_tail;
+        return true;
+    }
+
+    // sqes queued but not taken by the kernel yet
+    uint32_t Queued() const { return local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE); }
+    uint32_t SpaceLeft() const { return sq_entries - Queued(); }
+
+    // zeroed sqe, nullptr when the submission queue is full
+    io_uring_sqe* NextSqe()
+    {
+        if (SpaceLeft() == 0)
+            return nullptr;
+        uint32_t index = local_tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        local_tail++;
+        return sqe;
+    }
+
+    // submit everything queued, optionally waiting for wait_nr completions
+    int Submit(uint32_t wait_nr)
+    {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        uint32_t to_submit = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        for (;;)
+        {
+            int ret = int(syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return ret;
+        }
+    }
+
+    // wait for wait_nr completions without submitting anything
+    int Wait(uint32_t wait_nr)
+    {
+        for (;;)
+        {
+            int ret = int(syscall(__NR_io_uring_enter, ring_fd, 0, wait_nr, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return ret;
+        }
+    }
+
+    template<typename F>
+    void Reap(F&& on_complete)
+    {
+        uint32_t head = *cq_head;
+        uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+            on_complete(cqes[head & cq_mask]);
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void* Map(size_t size, uint64_t offset)
+    {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    template<typename T>
+    static T* Field(void* ring, uint32_t offset) { return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(ring) + offset); }
+
+    int ring_fd = -1;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+    uint32_t* sq_head = nullptr;
+    uint32_t* sq_tail = nullptr;
+    uint32_t* sq_array = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t sq_entries = 0;
+    uint32_t local_tail = 0;
+    uint32_t* cq_head = nullptr;
+    uint32_t* cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+#endif
+
+// --------------------
+// Output stage: decode threads Enqueue finished files into a bounded queue and a writer
+// thread drains it in batches. On Linux a batch is one round of io_uring openat for every
+// file, then a fallocate -> write -> close chain per file; elsewhere, or when io_uring is
+// unavailable, files are written one after another with ofstream. With packPath set every
+// file becomes a member of one tar stream instead, named by its generic path.
+class OutputWriter {
+public:
+    static constexpr uint64_t kAlignment = 4096;
+
+    struct Options {
+        uint32_t queueDepth = 256;      // queued files before Enqueue blocks
+        uint32_t batchSize = 32;        // files per io_uring round trip
+        uint64_t directThreshold = 0;   // files at least this big are written with O_DIRECT, 0 = never
+        bool useUring = true;
+        std::filesystem::path packPath;  // write one tar file instead of a file per job
+    };
+
+    OutputWriter() : OutputWriter(Options()) {}
+
+    explicit OutputWriter(const Options& options) : options(options)
+    {
+        if (!options.packPath.empty())
+        {
+            pack = std::make_unique<TarStream>();
+            if (!pack->Open(options.packPath))
+                failed++;
+        }
+#ifdef ARCHIVEDUMP_IO_URING
+        if (options.useUring && !pack)
+        {
+            ring = std::make_unique<IoUring>();
+            if (!ring->Init(256))
+                ring.reset();
+        }
+#endif
+        writer = std::thread([this] { WriterLoop(); });
+    }
+
+    ~OutputWriter()
+    {
+        Finish();
+        for (auto&& b : free_buffers)
+            ::operator delete[](b.data, std::align_val_t(kAlignment));
+    }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // 4 KiB aligned buffer padded to a whole block so it can go out with O_DIRECT. Buffers are
+    // recycled once the last reference is dropped; on_release runs at that point.
+    std::shared_ptr<unsigned char> AllocateBuffer(uint64_t size, std::function<void()> on_release = nullptr)
+    {
+        uint64_t capacity = (std::max)(size, uint64_t(64) << 10);
+        capacity = (capacity + kAlignment - 1) & ~(kAlignment - 1);
+        unsigned char* data = nullptr;
+        {
+            std::lock_guard<std::mutex> l(buffer_lock);
+            auto best = free_buffers.end();
+            for (auto it = free_buffers.begin(); it != free_buffers.end(); ++it)
+                if (it->capacity >= capacity && (best == free_buffers.end() || it->capacity < best->capacity))
+                    best = it;
+            if (best != free_buffers.end())
+            {
+                data = best->data;
+                capacity = best->capacity;
+                cached_bytes -= capacity;
+                free_buffers.erase(best);
+            }
+        }
+        if (!data)
+            data = static_cast<unsigned char*>(::operator new[](capacity, std::align_val_t(kAlignment)));
+        return std::shared_ptr<unsigned char>(data, [this, capacity, on_release = std::move(on_release)](unsigned char* p) {
+            RecycleBuffer(p, capacity);
+            if (on_release)
+                on_release();
+        });
+    }
+
+    void Enqueue(OutputJob job)
+    {
+        {
+            std::unique_lock<std::mutex> l(lock);
+            not_full.wait(l, [this] { return queue.size() < options.queueDepth; });
+            queue.emplace_back(std::move(job));
+            outstanding++;
+        }
+        not_empty.notify_one();
+    }
+
+    // block until everything enqueued so far is on disk
+    void Flush()
+    {
+        std::unique_lock<std::mutex> l(lock);
+        flushed.wait(l, [this] { return outstanding == 0; });
+    }
+
+    // write out everything enqueued, stop the writer thread and close the pack file, if any.
+    // Nothing may be enqueued afterwards.
+    void Finish()
+    {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            if (stopping)
+                return;
+            stopping = true;
+        }
+        not_empty.notify_all();
+        writer.join();
+        if (pack && !pack->Close())
+            failed++;
+    }
+
+    uint64_t Failed() const { return failed; }
+
+    bool Packing() const { return pack != nullptr; }
+
+    const char* Backend() const
+    {
+        if (pack)
+            return "tar";
+#ifdef ARCHIVEDUMP_IO_URING
+        if (ring)
+            return "io_uring";
+#endif
+        return "sync";
+    }
+
+private:
+    struct FreeBuffer {
+        unsigned char* data;
+        uint64_t capacity;
+    };
+
+    void RecycleBuffer(unsigned char* p, uint64_t capacity)
+    {
+        {
+            std::lock_guard<std::mutex> l(buffer_lock);
+            if (cached_bytes + capacity <= kMaxCachedBytes)
+            {
+                free_buffers.push_back({ p, capacity });
+                cached_bytes += capacity;
+                return;
+            }
+        }
+        ::operator delete[](p, std::align_val_t(kAlignment));
+    }
+
+    void WriterLoop()
+    {
+        std::vector<OutputJob> batch;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> l(lock);
+                not_empty.wait(l, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                while (!queue.empty() && batch.size() < options.batchSize)
+                {
+                    batch.emplace_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+            not_full.notify_all();
+
+            const size_t done = batch.size();
+            uint64_t bytes = 0;
+            for (auto&& job : batch)
+                bytes += job.size;
+            {
+                Telemetry::Scope write(Telemetry::kWrite, bytes);
+                if (pack)
+                {
+                    for (auto&& job : batch)
+                        if (!pack->Add(job.path.generic_string(), job.data, job.size))
+                            failed++;
+                }
+                else
+#ifdef ARCHIVEDUMP_IO_URING
+                if (ring)
+                    WriteBatchUring(batch);
+                else
+#endif
+                    for (auto&& job : batch)
+                        if (!WriteSync(job))
+                            failed++;
+            }
+
+            batch.clear();
+            {
+                std::lock_guard<std::mutex> l(lock);
+                outstanding -= done;
+            }
+            flushed.notify_all();
+        }
+    }
+
+    static bool WriteSync(const OutputJob& job)
+    {
+        std::ofstream of(job.path, std::ios::binary | std::ios::trunc);
+        of.write(reinterpret_cast<const char*>(job.data), job.size);
+        return bool(of);
+    }
+
+#ifdef ARCHIVEDUMP_IO_URING
+    enum : uint64_t { OP_OPEN, OP_FALLOCATE, OP_WRITE, OP_CLOSE };
+    static constexpr uint64_t kMaxWrite = uint64_t(1) << 30;
+
+    void WriteBatchUring(std::vector<OutputJob>& batch)
+    {
+        struct FileState {
+            int fd = -1;
+            bool direct = false;
+            uint64_t length = 0;    // bytes to write, padded to a block with O_DIRECT
+            uint64_t written = 0;
+            bool failed = false;
+            bool closed = false;
+        };
+        std::vector<FileState> files(batch.size());
+        uint32_t outstanding_cqes = 0;
+        bool ring_ok = true;
+
+        auto on_complete = [&](const io_uring_cqe& cqe) {
+            outstanding_cqes--;
+            auto& f = files[cqe.user_data >> 2];
+            switch (cqe.user_data & 3)
+            {
+            case OP_OPEN:
+                f.fd = cqe.res;
+                break;
+            case OP_WRITE:
+                if (cqe.res > 0)
+                    f.written += uint64_t(cqe.res);
+                else
+                    f.failed = true;
+                break;
+            case OP_CLOSE:
+                // a cancelled close left the fd open
+                f.closed = cqe.res != -ECANCELED;
+                break;
+            default:
+                // a failed fallocate or close does not invalidate what was written
+                break;
+            }
+        };
+        // The kernel reads the paths and buffers of the batch until their cqes are back, so
+        // nothing returns with requests in flight. EAGAIN and EBUSY only ask for completions
+        // to be reaped first, any other error leaves the ring unusable.
+        auto drain = [&] {
+            while (outstanding_cqes)
+            {
+                if (ring->Submit(1) < 0 && errno != EAGAIN && errno != EBUSY)
+                    return false;
+                ring->Reap(on_complete);
+            }
+            return true;
+        };
+        auto reserve = [&](uint32_t count) {
+            while (ring->SpaceLeft() < count)
+            {
+                if (ring->Submit(outstanding_cqes ? 1 : 0) < 0 && errno != EAGAIN && errno != EBUSY)
+                    return false;
+                ring->Reap(on_complete);
+            }
+            return true;
+        };
+        // what the kernel took is waited for, what is still queued is dropped with the ring
+        auto abandon = [&] {
+            while (outstanding_cqes > ring->Queued())
+            {
+                if (ring->Wait(1) < 0 && errno != EAGAIN && errno != EBUSY)
+                    return false;
+                ring->Reap(on_complete);
+            }
+            ring.reset();
+            return true;
+        };
+        auto push = [&](uint8_t opcode, size_t index, uint64_t op, int fd, uint8_t flags) {
+            io_uring_sqe* sqe = ring->NextSqe();
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->flags = flags;
+            sqe->user_data = (uint64_t(index) << 2) | op;
+            outstanding_cqes++;
+            return sqe;
+        };
+
+        // round 1: open every file of the batch
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            auto& job = batch[i];
+            auto& f = files[i];
+            f.direct = options.directThreshold && job.size >= options.directThreshold
+                && (reinterpret_cast<uintptr_t>(job.data) & (kAlignment - 1)) == 0;
+            f.length = f.direct ? (job.size + kAlignment - 1) & ~(kAlignment - 1) : job.size;
+            if (!(ring_ok = reserve(1)))
+                break;
+            auto sqe = push(IORING_OP_OPENAT, i, OP_OPEN, AT_FDCWD, 0);
+            sqe->addr = reinterpret_cast<uint64_t>(job.path.c_str());
+            sqe->len = 0644;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (f.direct ? O_DIRECT : 0);
+        }
+        ring_ok = ring_ok && drain();
+
+        // round 2: per file fallocate -> write(s) -> close, hard linked so close always runs
+        for (size_t i = 0; ring_ok && i < batch.size(); i++)
+        {
+            auto& job = batch[i];
+            auto& f = files[i];
+            if (f.fd == -EINVAL && f.direct)
+            {
+                // filesystem without O_DIRECT support
+                f.direct = false;
+                f.length = job.size;
+                f.fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            }
+            if (f.fd < 0)
+                continue;
+            const uint32_t chunks = uint32_t((f.length + kMaxWrite - 1) / kMaxWrite);
+            if (!(ring_ok = reserve(chunks + 2)))
+                break;
+            if (f.length)
+            {
+                auto sqe = push(IORING_OP_FALLOCATE, i, OP_FALLOCATE, f.fd, IOSQE_IO_HARDLINK);
+                sqe->off = 0;
+                sqe->addr = f.length;
+                sqe->len = 0;
+            }
+            for (uint64_t offset = 0; offset < f.length; offset += kMaxWrite)
+            {
+                auto sqe = push(IORING_OP_WRITE, i, OP_WRITE, f.fd, IOSQE_IO_HARDLINK);
+                sqe->addr = reinterpret_cast<uint64_t>(job.data + offset);
+                sqe->len = uint32_t((std::min)(kMaxWrite, f.length - offset));
+                sqe->off = offset;
+            }
+            push(IORING_OP_CLOSE, i, OP_CLOSE, f.fd, 0);
+        }
+        ring_ok = ring_ok && drain();
+
+        if (!ring_ok)
+        {
+            printf("[Output] io_uring failed (%s), writing the rest without it\n", strerror(errno));
+            if (!abandon())
+            {
+                // the kernel may still be reading this batch: keep it for good, count it lost
+                failed += batch.size();
+                new std::vector<OutputJob>(std::move(batch));
+                return;
+            }
+        }
+
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            auto& job = batch[i];
+            auto& f = files[i];
+            if (f.fd >= 0 && !f.closed)
+                close(f.fd);
+            bool ok = f.fd >= 0 && !f.failed && f.written == f.length;
+            if (ok && f.direct && f.length != job.size)
+                ok = truncate(job.path.c_str(), off_t(job.size)) == 0;
+            // opcode not supported by this kernel, short write, ...: redo it the plain way
+            if (!ok && !WriteSync(job))
+                failed++;
+        }
+    }
+
+    std::unique_ptr<IoUring> ring;
+#endif
+
+    static constexpr uint64_t kMaxCachedBytes = uint64_t(256) << 20;
+
+    Options options;
+    std::unique_ptr<TarStream> pack;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::condition_variable flushed;
+    std::deque<OutputJob> queue;
+    uint64_t outstanding = 0;       // enqueued, not yet written
+    bool stopping = false;
+    std::atomic<uint64_t> failed = 0;
+
+    std::mutex buffer_lock;
+    std::vector<FreeBuffer> free_buffers;
+    uint64_t cached_bytes = 0;
+};
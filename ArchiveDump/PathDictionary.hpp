@@ -0,0 +1,239 @@
+#pragma once
+
+#include "CR2W.hpp"
+
+#include <stdint.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// --------------------
+// Resource ids are FNV-1a 64 hashes of the depot path, lowercased with backslash separators.
+// The dictionary maps ids back to paths, filled from text lists (one path per line) and
+// from the imports of CR2W files seen during extraction. Add/Harvest may run concurrently.
+class PathDictionary {
+public:
+    static constexpr uint64_t kFnvOffset = 0xCBF29CE484222325ull;
+    static constexpr uint64_t kFnvPrime = 0x100000001B3ull;
+
+    static constexpr char NormalizeChar(char c)
+    {
+        if (c == '/')
+            return '\\';
+        if (c >= 'A' && c <= 'Z')
+            return char(c - 'A' + 'a');
+        return c;
+    }
+
+    static std::string Normalize(std::string_view path)
+    {
+        std::string s(path);
+        for (auto& c : s)
+            c = NormalizeChar(c);
+        return s;
+    }
+
+    static uint64_t Hash(std::string_view path)
+    {
+        uint64_t h = kFnvOffset;
+        for (char c : path)
+            h = (h ^ uint8_t(NormalizeChar(c))) * kFnvPrime;
+        return h;
+    }
+
+    // Hash many paths at once. FNV-1a is a serial chain per string, so kLanes strings are
+    // advanced side by side: the independent multiplies overlap instead of waiting on each
+    // other. Lanes whose string has ended keep their value.
+    static void HashBatch(std::span<const std::string_view> paths, std::span<uint64_t> out)
+    {
+        constexpr size_t kLanes = 8;
+        size_t i = 0;
+        for (; i + kLanes <= paths.size(); i += kLanes)
+        {
+            uint64_t h[kLanes];
+            size_t len[kLanes];
+            size_t common = SIZE_MAX;
+            for (size_t l = 0; l < kLanes; l++)
+            {
+                h[l] = kFnvOffset;
+                len[l] = paths[i + l].size();
+                common = (std::min)(common, len[l]);
+            }
+            // shared prefix length: no per lane bounds checks
+            for (size_t k = 0; k < common; k++)
+                for (size_t l = 0; l < kLanes; l++)
+                    h[l] = (h[l] ^ uint8_t(NormalizeChar(paths[i + l][k]))) * kFnvPrime;
+            for (size_t l = 0; l < kLanes; l++)
+            {
+                for (size_t k = common; k < len[l]; k++)
+                    h[l] = (h[l] ^ uint8_t(NormalizeChar(paths[i + l][k]))) * kFnvPrime;
+                out[i + l] = h[l];
+            }
+        }
+        for (; i < paths.size(); i++)
+            out[i] = Hash(paths[i]);
+    }
+
+    // '*' and '?' stay within one path component, "**" crosses separators. Both sides are
+    // compared normalized, so "base/characters/**" matches "Base\Characters\x.mesh".
+    static constexpr bool GlobMatch(std::string_view pattern, std::string_view path)
+    {
+        constexpr size_t npos = std::string_view::npos;
+        size_t p = 0, s = 0;
+        // the last '*' and the last '**' are kept apart: when the '*' cannot take one more
+        // character without crossing a separator, the '**' before it takes one instead
+        size_t star_p = npos, star_s = 0;
+        size_t any_p = npos, any_s = 0;
+        while (s < path.size())
+        {
+            if (p < pattern.size() && pattern[p] == '*')
+            {
+                if (p + 1 < pattern.size() && pattern[p + 1] == '*')
+                {
+                    p += 2;
+                    any_p = p;
+                    any_s = s;
+                    star_p = npos;
+                }
+                else
+                {
+                    p++;
+                    star_p = p;
+                    star_s = s;
+                }
+                continue;
+            }
+            char pc = p < pattern.size() ? NormalizeChar(pattern[p]) : 0;
+            char sc = NormalizeChar(path[s]);
+            if (p < pattern.size() && (pc == sc || (pc == '?' && sc != '\\')))
+            {
+                p++;
+                s++;
+                continue;
+            }
+            if (star_p != npos && NormalizeChar(path[star_s]) != '\\')
+            {
+                p = star_p;
+                s = ++star_s;
+                continue;
+            }
+            if (any_p != npos)
+            {
+                star_p = npos;
+                p = any_p;
+                s = ++any_s;
+                continue;
+            }
+            return false;
+        }
+        while (p < pattern.size() && pattern[p] == '*')
+            p++;
+        return p == pattern.size();
+    }
+
+    // returns false if the path was known already
+    bool Add(std::string_view path)
+    {
+        if (path.empty())
+            return false;
+        uint64_t id = Hash(path);
+        std::lock_guard<std::mutex> l(lock);
+        return paths.try_emplace(id, Normalize(path)).second;
+    }
+
+    // one path per line, blank lines and lines starting with '#' are skipped
+    size_t LoadText(const std::filesystem::path& file)
+    {
+        std::ifstream ifs(file, std::ios::binary);
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+                line.pop_back();
+            if (!line.empty() && line[0] != '#')
+                lines.push_back(Normalize(line));
+        }
+        std::vector<std::string_view> views(lines.begin(), lines.end());
+        std::vector<uint64_t> ids(lines.size());
+        HashBatch(views, ids);
+
+        size_t added = 0;
+        std::lock_guard<std::mutex> l(lock);
+        paths.reserve(paths.size() + lines.size());
+        for (size_t i = 0; i < lines.size(); i++)
+            added += paths.try_emplace(ids[i], std::move(lines[i])).second;
+        return added;
+    }
+
+    // sorted by path so the file diffs well between runs
+    bool SaveText(const std::filesystem::path& file)
+    {
+        std::vector<const std::string*> sorted;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            for (auto&& [id, path] : paths)
+                sorted.push_back(&path);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+        std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+        for (auto p : sorted)
+            ofs << *p << '\n';
+        return bool(ofs);
+    }
+
+    // depot paths of every import of a CR2W file, returns how many were new
+    size_t Harvest(CR2W* cr2w)
+    {
+        size_t added = 0;
+        for (auto&& ent : cr2w->entries<CR2WImport>())
+            added += Add(ent.GetDepotPath(cr2w));
+        return added;
+    }
+
+    // adds every path of other, returns how many were new
+    size_t Merge(PathDictionary& other)
+    {
+        std::vector<std::pair<uint64_t, std::string>> copied;
+        {
+            std::lock_guard<std::mutex> l(other.lock);
+            copied.assign(other.paths.begin(), other.paths.end());
+        }
+        size_t added = 0;
+        std::lock_guard<std::mutex> l(lock);
+        for (auto&& [id, path] : copied)
+            added += paths.try_emplace(id, std::move(path)).second;
+        return added;
+    }
+
+    // nullptr if the id is unknown. The string stays valid until the dictionary is destroyed.
+    const std::string* Find(uint64_t id)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        auto it = paths.find(id);
+        return it == paths.end() ? nullptr : &it->second;
+    }
+
+    size_t Size()
+    {
+        std::lock_guard<std::mutex> l(lock);
+        return paths.size();
+    }
+
+private:
+    std::mutex lock;
+    std::unordered_map<uint64_t, std::string> paths;
+};
+
+// a '*' that can no longer grow has to hand back to an earlier '**'
+static_assert(PathDictionary::GlobMatch("**/*.mesh", "base\\x\\y.mesh"));
+static_assert(PathDictionary::GlobMatch("**\\foo\\*.mesh", "a\\foo\\b\\foo\\c.mesh"));
+static_assert(PathDictionary::GlobMatch("base/characters/**", "Base\\Characters\\x.mesh"));
+static_assert(!PathDictionary::GlobMatch("base/*.mesh", "base\\x\\y.mesh"));
+static_assert(!PathDictionary::GlobMatch("**\\foo\\*.mesh", "a\\foo\\b\\c.mesh"));
@@ -1,256 +1,826 @@
-#pragma once
-
-#include <stdint.h>
-#include <lz4.h>
-#include <vector>
-#include <assert.h>
-
-#include <Windows.h>
-
-namespace zlib {
-    #include <zlib.h>
-}
-
-// ---- Reversed from official DumpArchive.exe ----
-
-#pragma pack(push, RDAR, 1)
-struct RedArchiveHeader {
-    uint32_t magic;
-    uint32_t version;
-    uint64_t indexPosition;
-    uint32_t indexSize;
-    uint64_t debugPosition;
-    uint32_t debugSize;
-    uint64_t totalFileSize;
-};
-
-struct RedArchiveDebug {
-    uint32_t buildMachine;
-    char computerName[64];
-    char buildName[64];
-};
-
-struct RedArchiveIndex {
-    uint32_t fileTableOffset;
-    uint32_t fileTableSize;
-};
-
-struct RedArchiveEntry {
-    // 0x38
-    uint64_t id;
-    uint64_t timestamp;
-    uint32_t numInlineBufferSegments;
-    uint32_t segmentsStart;
-    uint32_t segmentsEnd;
-    uint32_t resourceDependenciesStart;
-    uint32_t resourceDependenciesEnd;
-    uint8_t  hash[20];  // SHA-1
-};
-
-struct RedArchiveSegment {
-    // 0x10
-    uint64_t position;
-    uint32_t sizeOnDisk;
-    uint32_t sizeInMemory;
-};
-
-struct RedArchiveCompressed
-{
-    uint32_t magic;
-    uint32_t uncomp_size;
-    unsigned char data[0];
-};
-
-struct RedArchiveDependency {
-    // 0x8
-    uint64_t dependency;
-};
-
-
-struct RedArchiveFileTable {
-    uint64_t crc64;
-    uint32_t fileEntryCount;
-    uint32_t fileSegmentCount;
-    uint32_t resourceDependencyCount;
-};
-
-#pragma pack(pop, RDAR)
-
-struct RedArchiveFile {
-    std::vector<unsigned char> data;
-    std::vector<uint64_t> dependencies;
-    RedArchiveEntry entry;
-    bool compressed;
-
-    template<typename T>
-    T* Get()
-    {
-        return reinterpret_cast<T*>(data.data());
-    }
-};
-
-
-
-// -------------------- helpers -----------------------
-
-
-typedef int64_t (__fastcall *Fn_OodleLZ_Decompress)(unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize,
-    int64_t bFuzzSafe, int64_t bCheckCRC, int64_t verboseLevel, unsigned char* dictBackup, int64_t dictBackupSize, void* callback, int64_t a11, int64_t a12, int64_t a13, int64_t threadMode);
-
-typedef int64_t (__fastcall *Fn_OodleLZ_Compress)(int64_t algorithm, unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize, 
-    int64_t* a6, int64_t a7, int64_t a8, int64_t a9, int64_t compressLevel);
-
-typedef int64_t(__fastcall *Fn_OodleCore_Plugins_SetPrintf)(void*);
-
-/*
-static void OodleLog(uint64_t x, const char * filepath, uint64_t linenumber, const char* fmt, ...)
-{
-    va_list argptr;
-    printf("[LOG] %s:%lld ", filepath, linenumber);
-    va_start(argptr, fmt);
-    vprintf(fmt, argptr);
-    va_end(argptr);
-}
-*/
-
-class OodleHelper {
-public:
-    static void Initialize()
-    {
-        oo2 = LoadLibrary(L"oo2ext_7_win64.dll");
-        assert(oo2 != 0);
-        if (!oo2) return;
-        OodleLZ_Decompress = reinterpret_cast<Fn_OodleLZ_Decompress>(GetProcAddress(oo2, "OodleLZ_Decompress"));
-        OodleLZ_Compress = reinterpret_cast<Fn_OodleLZ_Compress>(GetProcAddress(oo2, "OodleLZ_Compress"));
-        Fn_OodleCore_Plugins_SetPrintf OodleCore_Plugins_SetPrintf = reinterpret_cast<Fn_OodleCore_Plugins_SetPrintf>(GetProcAddress(oo2, "OodleCore_Plugins_SetPrintf"));
-        // OodleCore_Plugins_SetPrintf(OodleLog);
-        assert(OodleLZ_Decompress && OodleLZ_Compress );
-    }
-
-    static void Finalize()
-    {
-        if (oo2)
-            FreeLibrary(oo2);
-    }
-
-    static int64_t Compress(int algo /* kraken=8 */, unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize, int64_t compressLevel=9)
-    {
-        return OodleLZ_Compress ? OodleLZ_Compress(algo, inputBuffer, inputBufferSize, outputBuffer, outputBufferSize, 0, 0, 0, 0, compressLevel) : 0;
-    }
-
-    static int64_t Decompress(unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize)
-    {
-        return OodleLZ_Decompress ? OodleLZ_Decompress(inputBuffer, inputBufferSize, outputBuffer, outputBufferSize,
-            0, 0, 0 /* loglevel */, 0, 0, 0, 0, 0, 0, 0) : 0;
-    }
-
-private:
-    inline static HMODULE oo2;
-    inline static Fn_OodleLZ_Decompress OodleLZ_Decompress;
-    inline static Fn_OodleLZ_Compress OodleLZ_Compress;
-};
-
-
-struct RedArchive {
-
-public:
-    RedArchive(void* buf)
-    {
-        header = Get<RedArchiveHeader>(0, buf);
-        assert(header->magic == 'RADR');
-        debug = Get<RedArchiveDebug>(sizeof(RedArchiveHeader));
-        index = Get<RedArchiveIndex>(header->indexPosition);
-        fileTable = Get<RedArchiveFileTable>(index->fileTableOffset, index);
-        entry = Get<RedArchiveEntry>(sizeof(RedArchiveFileTable), fileTable);
-        segment = Get<RedArchiveSegment>(sizeof(RedArchiveEntry) * fileTable->fileEntryCount, entry);
-        dependency = Get<RedArchiveDependency>(sizeof(RedArchiveSegment) * fileTable->fileSegmentCount, segment);
-    }
-
-    template<typename T>
-    T* Get(intptr_t offset, void* rel=nullptr)
-    {
-        if (rel == nullptr)
-            rel = header;
-        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(rel) + offset);
-    }
-
-    RedArchiveFile GetFile(uint32_t file_index)
-    {
-        std::vector<unsigned char> f;
-        std::vector<uint64_t> dep;
-        assert(file_index>=0 && file_index < fileTable->fileEntryCount);
-        auto& fentry = entry[file_index];
-
-        bool is_compressed = false;
-        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
-        {
-            auto& fseg = segment[seg_index];
-            // uncompressed
-            if (fseg.sizeInMemory == fseg.sizeOnDisk)
-            {
-                f.insert(f.end(), Get<unsigned char>(fseg.position), Get<unsigned char>(fseg.position + fseg.sizeOnDisk));
-                continue;
-            }
-
-            // compressed
-            auto arc = Get<RedArchiveCompressed>(fseg.position);
-            unsigned char* decompressed = new unsigned char[fseg.sizeInMemory];
-            memset(decompressed, 0, fseg.sizeInMemory);
-            assert(arc->uncomp_size == fseg.sizeInMemory);
-            int64_t decomp_len = 0;
-            switch (arc->magic)
-            {
-            case 'KRAK':
-                is_compressed = true;
-                decomp_len = OodleHelper::Decompress(arc->data, fseg.sizeOnDisk - sizeof(RedArchiveCompressed), decompressed, fseg.sizeInMemory);
-                break;
-            case 'XLZ4':
-                is_compressed = true;
-                decomp_len = LZ4_decompress_safe(reinterpret_cast<const char*>(arc->data), reinterpret_cast<char*>(decompressed),
-                    fseg.sizeOnDisk - sizeof(RedArchiveCompressed), fseg.sizeInMemory);
-                break;
-            case 'ZLIB':
-            {
-                is_compressed = true;
-                zlib::uLongf out_size = fseg.sizeInMemory;
-                int zlib_uncomp_ret = zlib::uncompress(decompressed, &out_size, arc->data, fseg.sizeOnDisk - sizeof(RedArchiveCompressed));
-                if (zlib_uncomp_ret == Z_OK)
-                    decomp_len = out_size;
-                else
-                    decomp_len = 0;
-                break;
-            }
-            default:
-                is_compressed = true;
-                // unknown compression
-                break;
-            }
-            assert(decomp_len == arc->uncomp_size);
-            if (decomp_len)
-            {
-                f.insert(f.end(), decompressed, decompressed + decomp_len);
-            }
-            else
-            {
-                // error or warn ?
-            }
-            delete[] decompressed;
-        }
-
-        for (uint32_t dep_index = fentry.resourceDependenciesStart; dep_index < fentry.resourceDependenciesEnd; dep_index++)
-        {
-            auto& fdep = dependency[dep_index];
-            dep.emplace_back(fdep.dependency);
-        }
-        return {f, dep, fentry, is_compressed};
-    }
-
-public:
-    RedArchiveHeader* header = nullptr;
-    RedArchiveDebug* debug = nullptr;
-    RedArchiveIndex* index = nullptr;
-    RedArchiveFileTable* fileTable = nullptr;
-    RedArchiveEntry* entry = nullptr;
-    RedArchiveSegment* segment = nullptr;
-    RedArchiveDependency* dependency = nullptr;
-};
+#pragma once
+
+#include <stdint.h>
+#include <lz4.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+#include <assert.h>
+
+#ifdef ARCHIVEDUMP_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <intrin.h>
+#define OODLE_CALL __fastcall
+#else
+#include <dlfcn.h>
+#define OODLE_CALL
+// zlib.h is wrapped in a namespace below, pull in the system headers zconf.h wants first
+#include <stddef.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace zlib {
+    #include <zlib.h>
+}
+
+// ---- Reversed from official DumpArchive.exe ----
+
+#pragma pack(push, RDAR, 1)
+struct RedArchiveHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t indexPosition;
+    uint32_t indexSize;
+    uint64_t debugPosition;
+    uint32_t debugSize;
+    uint64_t totalFileSize;
+};
+
+struct RedArchiveDebug {
+    uint32_t buildMachine;
+    char computerName[64];
+    char buildName[64];
+};
+
+struct RedArchiveIndex {
+    uint32_t fileTableOffset;
+    uint32_t fileTableSize;
+};
+
+struct RedArchiveEntry {
+    // 0x38
+    uint64_t id;
+    uint64_t timestamp;
+    uint32_t numInlineBufferSegments;
+    uint32_t segmentsStart;
+    uint32_t segmentsEnd;
+    uint32_t resourceDependenciesStart;
+    uint32_t resourceDependenciesEnd;
+    uint8_t  hash[20];  // SHA-1
+};
+
+struct RedArchiveSegment {
+    // 0x10
+    uint64_t position;
+    uint32_t sizeOnDisk;
+    uint32_t sizeInMemory;
+};
+
+struct RedArchiveCompressed
+{
+    uint32_t magic;
+    uint32_t uncomp_size;
+    unsigned char data[0];
+};
+
+struct RedArchiveDependency {
+    // 0x8
+    uint64_t dependency;
+};
+
+
+struct RedArchiveFileTable {
+    uint64_t crc64;
+    uint32_t fileEntryCount;
+    uint32_t fileSegmentCount;
+    uint32_t resourceDependencyCount;
+};
+
+#pragma pack(pop, RDAR)
+
+struct RedArchiveFile {
+    std::vector<unsigned char> data;
+    std::vector<uint64_t> dependencies;
+    RedArchiveEntry entry;
+    bool compressed;
+
+    template<typename T>
+    T* Get()
+    {
+        return reinterpret_cast<T*>(data.data());
+    }
+};
+
+
+
+// -------------------- helpers -----------------------
+
+
+typedef int64_t (OODLE_CALL *Fn_OodleLZ_Decompress)(unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize,
+    int64_t bFuzzSafe, int64_t bCheckCRC, int64_t verboseLevel, unsigned char* dictBackup, int64_t dictBackupSize, void* callback, int64_t a11, int64_t a12, int64_t a13, int64_t threadMode);
+
+typedef int64_t (OODLE_CALL *Fn_OodleLZ_Compress)(int64_t algorithm, unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize, 
+    int64_t* a6, int64_t a7, int64_t a8, int64_t a9, int64_t compressLevel);
+
+typedef int64_t(OODLE_CALL *Fn_OodleCore_Plugins_SetPrintf)(void*);
+
+/*
+static void OodleLog(uint64_t x, const char * filepath, uint64_t linenumber, const char* fmt, ...)
+{
+    va_list argptr;
+    printf("[LOG] %s:%lld ", filepath, linenumber);
+    va_start(argptr, fmt);
+    vprintf(fmt, argptr);
+    va_end(argptr);
+}
+*/
+
+// Kraken needs the Oodle library shipped with the game. Without it Initialize returns false,
+// KRAK segments fail to decode and everything else still works.
+class OodleHelper {
+public:
+#ifdef _WIN32
+    static bool Initialize(const wchar_t* library = L"oo2ext_7_win64.dll")
+    {
+        oo2 = LoadLibrary(library);
+        assert(oo2 != 0);
+        if (!oo2) return false;
+        OodleLZ_Decompress = reinterpret_cast<Fn_OodleLZ_Decompress>(GetProcAddress(oo2, "OodleLZ_Decompress"));
+        OodleLZ_Compress = reinterpret_cast<Fn_OodleLZ_Compress>(GetProcAddress(oo2, "OodleLZ_Compress"));
+        Fn_OodleCore_Plugins_SetPrintf OodleCore_Plugins_SetPrintf = reinterpret_cast<Fn_OodleCore_Plugins_SetPrintf>(GetProcAddress(oo2, "OodleCore_Plugins_SetPrintf"));
+        // OodleCore_Plugins_SetPrintf(OodleLog);
+        assert(OodleLZ_Decompress && OodleLZ_Compress );
+        return OodleLZ_Decompress != nullptr;
+    }
+
+    static void Finalize()
+    {
+        if (oo2)
+            FreeLibrary(oo2);
+    }
+#else
+    static bool Initialize(const char* library = "liboo2corelinux64.so.9")
+    {
+        oo2 = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+        if (!oo2) return false;
+        OodleLZ_Decompress = reinterpret_cast<Fn_OodleLZ_Decompress>(dlsym(oo2, "OodleLZ_Decompress"));
+        OodleLZ_Compress = reinterpret_cast<Fn_OodleLZ_Compress>(dlsym(oo2, "OodleLZ_Compress"));
+        return OodleLZ_Decompress != nullptr;
+    }
+
+    static void Finalize()
+    {
+        if (oo2)
+            dlclose(oo2);
+    }
+#endif
+
+    static bool Available() { return OodleLZ_Decompress != nullptr; }
+
+    static int64_t Compress(int algo /* kraken=8 */, unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize, int64_t compressLevel=9)
+    {
+        return OodleLZ_Compress ? OodleLZ_Compress(algo, inputBuffer, inputBufferSize, outputBuffer, outputBufferSize, 0, 0, 0, 0, compressLevel) : 0;
+    }
+
+    static int64_t Decompress(unsigned char* inputBuffer, int64_t inputBufferSize, unsigned char* outputBuffer, int64_t outputBufferSize)
+    {
+        return OodleLZ_Decompress ? OodleLZ_Decompress(inputBuffer, inputBufferSize, outputBuffer, outputBufferSize,
+            0, 0, 0 /* loglevel */, 0, 0, 0, 0, 0, 0, 0) : 0;
+    }
+
+private:
+#ifdef _WIN32
+    inline static HMODULE oo2;
+#else
+    inline static void* oo2;
+#endif
+    inline static Fn_OodleLZ_Decompress OodleLZ_Decompress;
+    inline static Fn_OodleLZ_Compress OodleLZ_Compress;
+};
+
+
+// --------------------
+// Segment codecs, keyed by the magic of RedArchiveCompressed. Decoders keep per-thread
+// state (an inflate stream reset with inflateReset instead of rebuilt per segment) and
+// Register replaces an existing magic, so a faster backend can be dropped in at startup.
+// Registration is not synchronized, do it before decoding starts.
+typedef int64_t (*Fn_SegmentDecode)(const unsigned char* src, uint64_t src_len, unsigned char* dst, uint64_t dst_len);
+
+struct CodecStats {
+    std::atomic<uint64_t> segments = 0;
+    std::atomic<uint64_t> failures = 0;
+    std::atomic<uint64_t> bytesIn = 0;
+    std::atomic<uint64_t> bytesOut = 0;
+    std::atomic<uint64_t> nanoseconds = 0;
+};
+
+class CodecRegistry {
+public:
+    static CodecRegistry& Instance()
+    {
+        static CodecRegistry registry;
+        return registry;
+    }
+
+    void Register(uint32_t magic, const char* name, Fn_SegmentDecode decode)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (codecs[i].magic == magic)
+            {
+                codecs[i].name = name;
+                codecs[i].decode = decode;
+                return;
+            }
+        }
+        assert(count < kMaxCodecs);
+        codecs[count].magic = magic;
+        codecs[count].name = name;
+        codecs[count].decode = decode;
+        count++;
+    }
+
+    // decode one segment payload, returns the decoded length or <= 0 on failure
+    int64_t Decode(uint32_t magic, const unsigned char* src, uint64_t src_len, unsigned char* dst, uint64_t dst_len)
+    {
+        Codec* codec = Find(magic);
+        if (!codec)
+        {
+            std::lock_guard<std::mutex> l(unknown_lock);
+            unknown[magic]++;
+            return 0;
+        }
+        auto start = std::chrono::steady_clock::now();
+        int64_t decoded = codec->decode(src, src_len, dst, dst_len);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        codec->stats.segments++;
+        codec->stats.bytesIn += src_len;
+        codec->stats.nanoseconds += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        if (decoded > 0)
+            codec->stats.bytesOut += uint64_t(decoded);
+        else
+            codec->stats.failures++;
+        return decoded;
+    }
+
+    const char* Name(uint32_t magic)
+    {
+        Codec* codec = Find(magic);
+        return codec ? codec->name : nullptr;
+    }
+
+    uint64_t UnknownSegments()
+    {
+        std::lock_guard<std::mutex> l(unknown_lock);
+        uint64_t total = 0;
+        for (auto&& [magic, segments] : unknown)
+            total += segments;
+        return total;
+    }
+
+    // per codec throughput, time is summed over all decoding threads
+    void PrintStats()
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            auto& st = codecs[i].stats;
+            if (!st.segments)
+                continue;
+            double seconds = double(st.nanoseconds) / 1e9;
+            printf("[Codec] %-10s segments: %llu, failed: %llu, in: %.1f MiB, out: %.1f MiB, %.1f MiB/s per thread\n",
+                codecs[i].name, (unsigned long long)st.segments.load(), (unsigned long long)st.failures.load(),
+                double(st.bytesIn) / 1048576.0, double(st.bytesOut) / 1048576.0,
+                seconds > 0 ? double(st.bytesOut) / 1048576.0 / seconds : 0.0);
+        }
+        std::lock_guard<std::mutex> l(unknown_lock);
+        for (auto&& [magic, segments] : unknown)
+        {
+            char name[5] = { char(magic >> 24), char(magic >> 16), char(magic >> 8), char(magic), 0 };
+            printf("[Codec] unknown magic %08x (%s): %llu segments not decoded\n", magic, name, (unsigned long long)segments);
+        }
+    }
+
+    // the same numbers as a JSON member, "codecs": { name: {...}, ... }
+    std::string StatsJson()
+    {
+        std::string json = "\"codecs\": {";
+        char line[256];
+        bool first = true;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            auto& st = codecs[i].stats;
+            if (!st.segments)
+                continue;
+            snprintf(line, sizeof(line), "%s\n    \"%s\": { \"segments\": %llu, \"failures\": %llu, \"bytesIn\": %llu, \"bytesOut\": %llu, \"ns\": %llu }",
+                first ? "" : ",", codecs[i].name, (unsigned long long)st.segments.load(), (unsigned long long)st.failures.load(),
+                (unsigned long long)st.bytesIn.load(), (unsigned long long)st.bytesOut.load(), (unsigned long long)st.nanoseconds.load());
+            json += line;
+            first = false;
+        }
+        json += first ? "}" : "\n  }";
+        return json;
+    }
+
+private:
+    struct Codec {
+        uint32_t magic = 0;
+        const char* name = nullptr;
+        Fn_SegmentDecode decode = nullptr;
+        CodecStats stats;
+    };
+
+    CodecRegistry()
+    {
+        Register('KRAK', "kraken", DecodeKraken);
+        Register('XLZ4', "lz4", DecodeLZ4);
+        Register('ZLIB', "zlib", DecodeZlib);
+#ifdef ARCHIVEDUMP_LIBDEFLATE
+        Register('ZLIB', "libdeflate", DecodeLibdeflate);
+#endif
+    }
+
+    Codec* Find(uint32_t magic)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            if (codecs[i].magic == magic)
+                return &codecs[i];
+        return nullptr;
+    }
+
+    static int64_t DecodeKraken(const unsigned char* src, uint64_t src_len, unsigned char* dst, uint64_t dst_len)
+    {
+        return OodleHelper::Decompress(const_cast<unsigned char*>(src), src_len, dst, dst_len);
+    }
+
+    static int64_t DecodeLZ4(const unsigned char* src, uint64_t src_len, unsigned char* dst, uint64_t dst_len)
+    {
+        return LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst), int(src_len), int(dst_len));
+    }
+
+    static int64_t DecodeZlib(const unsigned char* src, uint64_t src_len, unsigned char* dst, uint64_t dst_len)
+    {
+        // one inflate state per thread, reset between segments
+        struct InflateContext {
+            zlib::z_stream stream{};
+            bool ready = false;
+            InflateContext() { ready = zlib::inflateInit_(&stream, ZLIB_VERSION, int(sizeof(zlib::z_stream))) == Z_OK; }
+            ~InflateContext() { if (ready) zlib::inflateEnd(&stream); }
+        };
+        thread_local InflateContext ctx;
+        if (!ctx.ready || zlib::inflateReset(&ctx.stream) != Z_OK)
+            return 0;
+        ctx.stream.next_in = const_cast<unsigned char*>(src);
+        ctx.stream.avail_in = zlib::uInt(src_len);
+        ctx.stream.next_out = dst;
+        ctx.stream.avail_out = zlib::uInt(dst_len);
+        if (zlib::inflate(&ctx.stream, Z_FINISH) != Z_STREAM_END)
+            return 0;
+        return int64_t(ctx.stream.total_out);
+    }
+
+#ifdef ARCHIVEDUMP_LIBDEFLATE
+    static int64_t DecodeLibdeflate(const unsigned char* src, uint64_t src_len, unsigned char* dst, uint64_t dst_len)
+    {
+        struct DeflateContext {
+            libdeflate_decompressor* d = libdeflate_alloc_decompressor();
+            ~DeflateContext() { if (d) libdeflate_free_decompressor(d); }
+        };
+        thread_local DeflateContext ctx;
+        size_t out_len = 0;
+        if (!ctx.d || libdeflate_zlib_decompress(ctx.d, src, src_len, dst, dst_len, &out_len) != LIBDEFLATE_SUCCESS)
+            return 0;
+        return int64_t(out_len);
+    }
+#endif
+
+    static constexpr uint32_t kMaxCodecs = 16;
+    Codec codecs[kMaxCodecs];
+    uint32_t count = 0;
+    std::mutex unknown_lock;
+    std::map<uint32_t, uint64_t> unknown;
+};
+
+
+// CRC-64/ECMA-182 (poly 0x42F0E1EBA9EA3693, no reflection, init and xorout 0), the variant
+// of .NET's System.IO.Hashing.Crc64
+static uint64_t Crc64Ecma(const unsigned char* data, size_t size, uint64_t crc = 0)
+{
+    struct Table {
+        uint64_t t[256];
+        Table()
+        {
+            for (uint64_t i = 0; i < 256; i++)
+            {
+                uint64_t c = i << 56;
+                for (int k = 0; k < 8; k++)
+                    c = (c << 1) ^ ((c >> 63) ? 0x42F0E1EBA9EA3693ull : 0);
+                t[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    for (size_t i = 0; i < size; i++)
+        crc = table.t[uint8_t(crc >> 56) ^ data[i]] ^ (crc << 8);
+    return crc;
+}
+
+
+// file size and file table crc64 of a mapped archive, false if it is not a RADR archive.
+// Only the header and the first bytes of the index are touched.
+inline bool GetArchiveStamp(const void* data, uint64_t size, uint64_t& crc64)
+{
+    auto header = reinterpret_cast<const RedArchiveHeader*>(data);
+    if (size < sizeof(RedArchiveHeader) || header->magic != 'RADR'
+        || header->indexPosition + sizeof(RedArchiveIndex) > size)
+        return false;
+    auto index = reinterpret_cast<const RedArchiveIndex*>(reinterpret_cast<const unsigned char*>(data) + header->indexPosition);
+    if (header->indexPosition + index->fileTableOffset + sizeof(RedArchiveFileTable) > size)
+        return false;
+    auto table = reinterpret_cast<const RedArchiveFileTable*>(reinterpret_cast<const unsigned char*>(index) + index->fileTableOffset);
+    crc64 = table->crc64;
+    return true;
+}
+
+// RedArchive trusts its tables: check that every table, segment and dependency range of a
+// mapped archive is inside it before constructing one
+inline bool ArchiveTablesInBounds(const void* data, uint64_t size)
+{
+    auto base = reinterpret_cast<const unsigned char*>(data);
+    auto header = reinterpret_cast<const RedArchiveHeader*>(base);
+    if (size < sizeof(RedArchiveHeader) || header->magic != 'RADR'
+        || header->indexPosition + sizeof(RedArchiveIndex) > size || header->indexPosition + header->indexSize > size)
+        return false;
+    auto index = reinterpret_cast<const RedArchiveIndex*>(base + header->indexPosition);
+    uint64_t table_pos = header->indexPosition + index->fileTableOffset;
+    if (table_pos + sizeof(RedArchiveFileTable) > size)
+        return false;
+    auto table = reinterpret_cast<const RedArchiveFileTable*>(base + table_pos);
+    uint64_t entries_pos = table_pos + sizeof(RedArchiveFileTable);
+    uint64_t segments_pos = entries_pos + uint64_t(table->fileEntryCount) * sizeof(RedArchiveEntry);
+    uint64_t deps_pos = segments_pos + uint64_t(table->fileSegmentCount) * sizeof(RedArchiveSegment);
+    if (deps_pos + uint64_t(table->resourceDependencyCount) * sizeof(RedArchiveDependency) > size)
+        return false;
+
+    auto entries = reinterpret_cast<const RedArchiveEntry*>(base + entries_pos);
+    auto segments = reinterpret_cast<const RedArchiveSegment*>(base + segments_pos);
+    for (uint32_t i = 0; i < table->fileEntryCount; i++)
+    {
+        auto& e = entries[i];
+        if (e.segmentsStart > e.segmentsEnd || e.segmentsEnd > table->fileSegmentCount
+            || e.resourceDependenciesStart > e.resourceDependenciesEnd || e.resourceDependenciesEnd > table->resourceDependencyCount)
+            return false;
+    }
+    for (uint32_t s = 0; s < table->fileSegmentCount; s++)
+    {
+        auto& seg = segments[s];
+        if (seg.position + seg.sizeOnDisk > size
+            || (seg.sizeOnDisk != seg.sizeInMemory && seg.sizeOnDisk < sizeof(RedArchiveCompressed)))
+            return false;
+    }
+    return true;
+}
+
+
+struct RedArchive {
+
+public:
+    RedArchive(void* buf)
+    {
+        header = Get<RedArchiveHeader>(0, buf);
+        assert(header->magic == 'RADR');
+        debug = Get<RedArchiveDebug>(sizeof(RedArchiveHeader));
+        index = Get<RedArchiveIndex>(header->indexPosition);
+        fileTable = Get<RedArchiveFileTable>(index->fileTableOffset, index);
+        entry = Get<RedArchiveEntry>(sizeof(RedArchiveFileTable), fileTable);
+        segment = Get<RedArchiveSegment>(sizeof(RedArchiveEntry) * fileTable->fileEntryCount, entry);
+        dependency = Get<RedArchiveDependency>(sizeof(RedArchiveSegment) * fileTable->fileSegmentCount, segment);
+        BuildIdTable();
+    }
+
+    static constexpr uint32_t kNotFound = UINT32_MAX;
+
+    // index of the entry with this resource id, kNotFound if the archive does not have it
+    uint32_t FindFile(uint64_t id) const
+    {
+        for (uint64_t slot = IdSlot(id);; slot = (slot + 1) & id_mask)
+        {
+            const IdSlotEntry& s = id_table[slot];
+            if (s.index == kNotFound || s.id == id)
+                return s.index;
+        }
+    }
+
+    // FindFile for many ids, out[i] receives the index for ids[i]. Slots are prefetched a
+    // group ahead so the probes of a large batch overlap their cache misses.
+    void FindFiles(std::span<const uint64_t> ids, std::span<uint32_t> out) const
+    {
+        assert(out.size() >= ids.size());
+        constexpr size_t kGroup = 16;
+        uint64_t slots[kGroup];
+        for (size_t base = 0; base < ids.size(); base += kGroup)
+        {
+            size_t n = (std::min)(kGroup, ids.size() - base);
+            for (size_t i = 0; i < n; i++)
+            {
+                slots[i] = IdSlot(ids[base + i]);
+                Prefetch(&id_table[slots[i]]);
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                uint64_t id = ids[base + i];
+                for (uint64_t slot = slots[i];; slot = (slot + 1) & id_mask)
+                {
+                    const IdSlotEntry& s = id_table[slot];
+                    if (s.index == kNotFound || s.id == id)
+                    {
+                        out[base + i] = s.index;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    T* Get(intptr_t offset, void* rel=nullptr)
+    {
+        if (rel == nullptr)
+            rel = header;
+        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(rel) + offset);
+    }
+
+    // decompressed size of an entry: sum of its segments' sizeInMemory
+    uint64_t GetDecompressedSize(uint32_t file_index)
+    {
+        assert(file_index < fileTable->fileEntryCount);
+        auto& fentry = entry[file_index];
+        uint64_t size = 0;
+        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+            size += segment[seg_index].sizeInMemory;
+        return size;
+    }
+
+    // the biggest sizeInMemory among an entry's segments
+    uint64_t GetLargestSegment(uint32_t file_index)
+    {
+        assert(file_index < fileTable->fileEntryCount);
+        auto& fentry = entry[file_index];
+        uint64_t size = 0;
+        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+            size = (std::max)(size, uint64_t(segment[seg_index].sizeInMemory));
+        return size;
+    }
+
+    // An entry whose segments are all stored and laid out back to back is returned as a view
+    // into the mapped archive without copying. Empty span if the entry has to be decompressed.
+    std::span<const unsigned char> GetFileView(uint32_t file_index)
+    {
+        assert(file_index < fileTable->fileEntryCount);
+        auto& fentry = entry[file_index];
+        if (fentry.segmentsStart >= fentry.segmentsEnd)
+            return {};
+        uint64_t end = segment[fentry.segmentsStart].position;
+        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+        {
+            auto& fseg = segment[seg_index];
+            if (fseg.sizeInMemory != fseg.sizeOnDisk || fseg.position != end)
+                return {};
+            end += fseg.sizeOnDisk;
+        }
+        uint64_t start = segment[fentry.segmentsStart].position;
+        return { Get<const unsigned char>(start), size_t(end - start) };
+    }
+
+    // Decompress an entry into a caller-owned buffer of at least GetDecompressedSize() bytes.
+    // Codecs write straight into their slice of out. Returns the number of bytes written, a
+    // segment that fails to decode is skipped like GetFile always did, so any failure shows
+    // as a result shorter than GetDecompressedSize().
+    uint64_t DecompressFile(uint32_t file_index, std::span<unsigned char> out, bool* compressed = nullptr)
+    {
+        assert(file_index < fileTable->fileEntryCount);
+        auto& fentry = entry[file_index];
+
+        bool is_compressed = false;
+        uint64_t written = 0;
+        for (uint32_t seg_index = fentry.segmentsStart; seg_index < fentry.segmentsEnd; seg_index++)
+        {
+            assert(written + segment[seg_index].sizeInMemory <= out.size());
+            is_compressed |= segment[seg_index].sizeInMemory != segment[seg_index].sizeOnDisk;
+            // failed and unknown segments are counted by CodecRegistry and reported at the end
+            int64_t decomp_len = DecodeSegment(seg_index, out.data() + written);
+            if (decomp_len > 0)
+                written += decomp_len;
+        }
+        if (compressed)
+            *compressed = is_compressed;
+        return written;
+    }
+
+    // runs fn(0) .. fn(count - 1), possibly concurrently, and returns when all are done
+    typedef std::function<void(uint32_t count, const std::function<void(uint32_t)>& fn)> ParallelFor;
+
+    // DecompressFile with the segments decoded through parallel_for. Every segment is
+    // compressed on its own, so each one decodes straight into its final slice of out, at the
+    // prefix sum of the sizeInMemory before it. Same result as DecompressFile: if a segment
+    // fails, the ones after it are moved down over its slice.
+    uint64_t DecompressFile(uint32_t file_index, std::span<unsigned char> out, const ParallelFor& parallel_for, bool* compressed = nullptr)
+    {
+        assert(file_index < fileTable->fileEntryCount);
+        auto& fentry = entry[file_index];
+        const uint32_t count = fentry.segmentsEnd - fentry.segmentsStart;
+
+        bool is_compressed = false;
+        std::vector<uint64_t> offsets(count + 1, 0);
+        for (uint32_t k = 0; k < count; k++)
+        {
+            auto& fseg = segment[fentry.segmentsStart + k];
+            is_compressed |= fseg.sizeInMemory != fseg.sizeOnDisk;
+            offsets[k + 1] = offsets[k] + fseg.sizeInMemory;
+        }
+        assert(offsets[count] <= out.size());
+
+        std::vector<int64_t> lengths(count);
+        parallel_for(count, [&](uint32_t k) { lengths[k] = DecodeSegment(fentry.segmentsStart + k, out.data() + offsets[k]); });
+
+        uint64_t written = 0;
+        for (uint32_t k = 0; k < count; k++)
+        {
+            if (lengths[k] <= 0)
+                continue;
+            if (written != offsets[k])
+                memmove(out.data() + written, out.data() + offsets[k], size_t(lengths[k]));
+            written += uint64_t(lengths[k]);
+        }
+        if (compressed)
+            *compressed = is_compressed;
+        return written;
+    }
+
+    // receives an entry's bytes one segment at a time, returns false to stop
+    typedef std::function<bool(std::span<const unsigned char>)> SegmentSink;
+
+    // Hand an entry to sink segment by segment, in order, each as soon as it is decoded. Stored
+    // segments come straight out of the mapping, compressed ones are decoded into scratch,
+    // which grows to GetLargestSegment(), so memory is bounded by one segment however big the
+    // entry. Returns the number of bytes passed on; a segment that fails to decode is skipped
+    // as in DecompressFile.
+    uint64_t StreamFile(uint32_t file_index, const SegmentSink& sink, std::vector<unsigned char>& scratch, bool* compressed = nullptr)
+    {
+        auto serial = [](uint32_t count, const std::function<void(uint32_t)>& fn) {
+            for (uint32_t k = 0; k < count; k++)
+                fn(k);
+        };
+        return StreamFile(file_index, sink, scratch, serial, 1, compressed);
+    }
+
+    // StreamFile decoding window segments at a time through parallel_for, scratch then grows
+    // to window times the largest segment
+    uint64_t StreamFile(uint32_t file_index, const SegmentSink& sink, std::vector<unsigned char>& scratch, const ParallelFor& parallel_for,
+        uint32_t window, bool* compressed = nullptr)
+    {
+        assert(file_index < fileTable->fileEntryCount && window > 0);
+        auto& fentry = entry[file_index];
+        const uint64_t slot = GetLargestSegment(file_index);
+        if (scratch.size() < slot * window)
+            scratch.resize(size_t(slot * window));
+
+        bool is_compressed = false;
+        uint64_t passed = 0;
+        std::vector<int64_t> lengths(window);
+        for (uint32_t first = fentry.segmentsStart; first < fentry.segmentsEnd; first += window)
+        {
+            uint32_t count = (std::min)(window, fentry.segmentsEnd - first);
+            parallel_for(count, [&](uint32_t k) {
+                auto& fseg = segment[first + k];
+                // stored segments are passed out of the mapping, not copied
+                lengths[k] = fseg.sizeInMemory == fseg.sizeOnDisk ? int64_t(fseg.sizeOnDisk) : DecodeSegment(first + k, scratch.data() + slot * k);
+            });
+            for (uint32_t k = 0; k < count; k++)
+            {
+                auto& fseg = segment[first + k];
+                bool stored = fseg.sizeInMemory == fseg.sizeOnDisk;
+                is_compressed |= !stored;
+                if (!stored && lengths[k] <= 0)
+                    continue;
+                std::span<const unsigned char> piece = { stored ? Get<const unsigned char>(fseg.position) : scratch.data() + slot * k, size_t(lengths[k]) };
+                passed += piece.size();
+                if (!sink(piece))
+                {
+                    if (compressed)
+                        *compressed = is_compressed;
+                    return passed;
+                }
+            }
+        }
+        if (compressed)
+            *compressed = is_compressed;
+        return passed;
+    }
+
+    // Checksum over the file table after its crc64 field (counts, entries, segments and
+    // dependencies). Which bytes the game covers is not documented, treat a mismatch as a hint.
+    uint64_t ComputeFileTableCrc64()
+    {
+        auto begin = reinterpret_cast<const unsigned char*>(fileTable) + sizeof(fileTable->crc64);
+        auto end = reinterpret_cast<const unsigned char*>(fileTable) + index->fileTableSize;
+        return end > begin ? Crc64Ecma(begin, size_t(end - begin)) : 0;
+    }
+
+    RedArchiveFile GetFile(uint32_t file_index)
+    {
+        assert(file_index < fileTable->fileEntryCount);
+        auto& fentry = entry[file_index];
+        RedArchiveFile f{ {}, {}, fentry, false };
+
+        f.data.resize(GetDecompressedSize(file_index));
+        f.data.resize(DecompressFile(file_index, f.data, &f.compressed));
+
+        f.dependencies.reserve(fentry.resourceDependenciesEnd - fentry.resourceDependenciesStart);
+        for (uint32_t dep_index = fentry.resourceDependenciesStart; dep_index < fentry.resourceDependenciesEnd; dep_index++)
+        {
+            auto& fdep = dependency[dep_index];
+            f.dependencies.emplace_back(fdep.dependency);
+        }
+        return f;
+    }
+
+private:
+    // one segment into dst, which has room for its sizeInMemory; the decoded length, <= 0 on failure
+    int64_t DecodeSegment(uint32_t seg_index, unsigned char* dst)
+    {
+        auto& fseg = segment[seg_index];
+        if (fseg.sizeInMemory == fseg.sizeOnDisk)
+        {
+            memcpy(dst, Get<unsigned char>(fseg.position), fseg.sizeOnDisk);
+            return int64_t(fseg.sizeOnDisk);
+        }
+        // a frame that disagrees with its segment, a missing codec or a short decode is a
+        // failed segment; the entry comes out short and the caller reports it
+        if (fseg.sizeOnDisk < sizeof(RedArchiveCompressed))
+            return -1;
+        auto arc = Get<RedArchiveCompressed>(fseg.position);
+        if (arc->uncomp_size != fseg.sizeInMemory)
+            return -1;
+        int64_t decomp_len = CodecRegistry::Instance().Decode(arc->magic, arc->data, fseg.sizeOnDisk - sizeof(RedArchiveCompressed), dst, fseg.sizeInMemory);
+        return decomp_len == int64_t(fseg.sizeInMemory) ? decomp_len : -1;
+    }
+
+    struct IdSlotEntry {
+        uint64_t id;
+        uint32_t index;
+    };
+
+    // Linear probing table at most half full, sized once from fileEntryCount. Ids are already
+    // hashes of the resource path, the multiply only spreads them over the low bits.
+    void BuildIdTable()
+    {
+        uint64_t capacity = 16;
+        while (capacity < uint64_t(fileTable->fileEntryCount) * 2)
+            capacity <<= 1;
+        id_mask = capacity - 1;
+        id_shift = 64;
+        for (uint64_t c = capacity; c > 1; c >>= 1)
+            id_shift--;
+        id_table.assign(capacity, IdSlotEntry{ 0, kNotFound });
+        for (uint32_t i = 0; i < fileTable->fileEntryCount; i++)
+        {
+            uint64_t id = entry[i].id;
+            uint64_t slot = IdSlot(id);
+            // duplicate ids keep the first entry
+            while (id_table[slot].index != kNotFound && id_table[slot].id != id)
+                slot = (slot + 1) & id_mask;
+            if (id_table[slot].index == kNotFound)
+                id_table[slot] = { id, i };
+        }
+    }
+
+    uint64_t IdSlot(uint64_t id) const { return (id * 0x9E3779B97F4A7C15ull) >> id_shift; }
+
+    static void Prefetch(const void* p)
+    {
+#ifdef _MSC_VER
+        _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0);
+#else
+        __builtin_prefetch(p);
+#endif
+    }
+
+    std::vector<IdSlotEntry> id_table;
+    uint64_t id_mask = 0;
+    uint32_t id_shift = 64;
+
+public:
+    RedArchiveHeader* header = nullptr;
+    RedArchiveDebug* debug = nullptr;
+    RedArchiveIndex* index = nullptr;
+    RedArchiveFileTable* fileTable = nullptr;
+    RedArchiveEntry* entry = nullptr;
+    RedArchiveSegment* segment = nullptr;
+    RedArchiveDependency* dependency = nullptr;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "MappedArchiveFile.hpp"
+
+#include <stdint.h>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// --------------------
+// One .archive for embedding: owns its mapping, may be called from any number of threads, and
+// keeps recently decoded entries in a size bounded LRU cache. The cache is split into shards
+// by entry index, each with its own lock, so lookups of different entries rarely contend.
+// Entries are handed out as shared immutable RedArchiveFiles that own their bytes and stay
+// valid after eviction or Close. A miss on an entry another thread is already decoding waits
+// for that decode instead of starting a second one.
+class RedArchiveReader {
+public:
+    struct Options {
+        uint64_t cacheBytes = 256ull << 20;     // decoded bytes kept over all shards, 0 = no cache
+        uint32_t shards = 16;
+        MappedArchiveFile::Options map = { .sequential = false };   // lookups are random access
+    };
+
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;        // decoded, including entries too large to be cached
+        uint64_t waits = 0;         // misses served by another thread's decode
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    using FilePtr = std::shared_ptr<const RedArchiveFile>;
+
+    RedArchiveReader() = default;
+    RedArchiveReader(const RedArchiveReader&) = delete;
+    RedArchiveReader& operator=(const RedArchiveReader&) = delete;
+
+    bool Open(const std::filesystem::path& path) { return Open(path, Options()); }
+
+    // false if the file cannot be mapped or its tables do not fit inside it
+    bool Open(const std::filesystem::path& path, const Options& options)
+    {
+        Close();
+        file = std::make_unique<MappedArchiveFile>();
+        if (!file->Open(path, options.map) || !ArchiveTablesInBounds(file->Data(), file->Size()))
+        {
+            file.reset();
+            return false;
+        }
+        auto header = reinterpret_cast<const RedArchiveHeader*>(file->Data());
+        file->AdviseWillNeed(header->indexPosition, header->indexSize);
+        archive = std::make_unique<RedArchive>(file->Data());
+
+        shards = std::vector<Shard>((std::max)(options.shards, 1u));
+        shard_capacity = options.cacheBytes / shards.size();
+        return true;
+    }
+
+    // files already handed out stay valid
+    void Close()
+    {
+        shards.clear();
+        archive.reset();
+        file.reset();
+    }
+
+    bool IsOpen() const { return archive != nullptr; }
+
+    // the raw tables, read only
+    const RedArchive& Archive() const { return *archive; }
+    uint32_t EntryCount() const { return archive->fileTable->fileEntryCount; }
+    const RedArchiveEntry& Entry(uint32_t file_index) const { return archive->entry[file_index]; }
+    uint32_t Find(uint64_t id) const { return archive->FindFile(id); }
+
+    // null if file_index is out of range
+    FilePtr GetFile(uint32_t file_index)
+    {
+        if (file_index >= EntryCount())
+            return nullptr;
+        Shard& shard = shards[ShardOf(file_index)];
+        std::unique_lock<std::mutex> l(shard.lock);
+        auto it = shard.map.find(file_index);
+        if (it != shard.map.end())
+        {
+            shard.stats.hits++;
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->file;
+        }
+        auto pending = shard.pending.find(file_index);
+        if (pending != shard.pending.end())
+        {
+            shard.stats.waits++;
+            auto future = pending->second;
+            l.unlock();
+            return future.get();
+        }
+        shard.stats.misses++;
+        std::promise<FilePtr> promise;
+        shard.pending.emplace(file_index, promise.get_future().share());
+        l.unlock();
+
+        FilePtr f = std::make_shared<const RedArchiveFile>(archive->GetFile(file_index));
+
+        l.lock();
+        shard.pending.erase(file_index);
+        Insert(shard, file_index, f);
+        l.unlock();
+        promise.set_value(f);
+        return f;
+    }
+
+    // null if the archive has no such resource
+    FilePtr GetFileById(uint64_t id)
+    {
+        uint32_t file_index = Find(id);
+        return file_index == RedArchive::kNotFound ? nullptr : GetFile(file_index);
+    }
+
+    CacheStats Stats()
+    {
+        CacheStats total;
+        for (auto& shard : shards)
+        {
+            std::lock_guard<std::mutex> l(shard.lock);
+            total.hits += shard.stats.hits;
+            total.misses += shard.stats.misses;
+            total.waits += shard.stats.waits;
+            total.evictions += shard.stats.evictions;
+            total.entries += shard.map.size();
+            total.bytes += shard.bytes;
+        }
+        return total;
+    }
+
+    // drop every cached entry, statistics are kept
+    void Clear()
+    {
+        for (auto& shard : shards)
+        {
+            std::lock_guard<std::mutex> l(shard.lock);
+            shard.lru.clear();
+            shard.map.clear();
+            shard.bytes = 0;
+        }
+    }
+
+private:
+    struct Cached {
+        uint32_t index;
+        uint64_t charge;
+        FilePtr file;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        std::list<Cached> lru;      // most recently used first
+        std::unordered_map<uint32_t, std::list<Cached>::iterator> map;
+        std::unordered_map<uint32_t, std::shared_future<FilePtr>> pending;
+        uint64_t bytes = 0;
+        CacheStats stats;
+    };
+
+    size_t ShardOf(uint32_t file_index) const
+    {
+        return size_t((uint64_t(file_index) * 0x9E3779B97F4A7C15ull) >> 32) % shards.size();
+    }
+
+    // called with the shard locked; entries larger than a shard are not kept
+    void Insert(Shard& shard, uint32_t file_index, const FilePtr& f)
+    {
+        uint64_t charge = sizeof(RedArchiveFile) + f->data.size() + f->dependencies.size() * sizeof(uint64_t);
+        if (charge > shard_capacity)
+            return;
+        while (shard.bytes + charge > shard_capacity && !shard.lru.empty())
+        {
+            auto& victim = shard.lru.back();
+            shard.bytes -= victim.charge;
+            shard.map.erase(victim.index);
+            shard.lru.pop_back();
+            shard.stats.evictions++;
+        }
+        shard.lru.push_front({ file_index, charge, f });
+        shard.map[file_index] = shard.lru.begin();
+        shard.bytes += charge;
+    }
+
+    std::unique_ptr<MappedArchiveFile> file;
+    std::unique_ptr<RedArchive> archive;
+    std::vector<Shard> shards;
+    uint64_t shard_capacity = 0;
+};
@@ -0,0 +1,313 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "Sha1.hpp"
+#include "ThreadPool.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// --------------------
+// Builds a .archive. Files are cut into segments of at most segmentSize bytes; the first
+// segment is the file itself up to that size, the others count as its inline buffers. Every
+// segment is compressed on the pool while the caller keeps adding files, and segments are
+// written in the order they were added as soon as they are done, so the data region streams
+// out front to back. Finish writes the index: file table, entries, segments and
+// dependencies, then the header. A segment that does not get smaller is stored.
+// Not thread safe, add files from one thread.
+class RedArchiveWriter {
+public:
+    enum Codec { kStored, kLZ4, kZlib, kKraken, kAuto };
+
+    struct Options {
+        Codec codec = kAuto;                // kKraken where Oodle is loaded, kLZ4 otherwise
+        int level = -1;                     // codec level, -1 = default (zlib 6, Kraken 4)
+        uint32_t segmentSize = 1 << 20;
+        uint32_t threads = 0;               // 0 = one per core
+        uint64_t maxInFlight = 256ull << 20;    // input bytes queued or being compressed
+        bool hashes = true;                 // entry SHA-1 and file table crc64
+    };
+
+    static constexpr uint32_t kDataStart = 0x1000;
+
+    RedArchiveWriter() = default;
+    ~RedArchiveWriter() { Finish(); }
+    RedArchiveWriter(const RedArchiveWriter&) = delete;
+    RedArchiveWriter& operator=(const RedArchiveWriter&) = delete;
+
+    static const char* CodecName(Codec codec)
+    {
+        static const char* names[] = { "stored", "lz4", "zlib", "kraken", "auto" };
+        return names[codec];
+    }
+
+    bool Open(const std::filesystem::path& path) { return Open(path, Options()); }
+
+    bool Open(const std::filesystem::path& path, const Options& options)
+    {
+        this->options = options;
+        if (this->options.codec == kAuto)
+            this->options.codec = OodleHelper::Available() ? kKraken : kLZ4;
+        if (this->options.segmentSize == 0)
+            this->options.segmentSize = 1 << 20;
+        out.open(path, std::ios::binary | std::ios::trunc);
+        std::vector<char> zero(kDataStart, 0);
+        out.write(zero.data(), zero.size());
+        position = kDataStart;
+        failed = !out;
+        pool = std::make_unique<ThreadPool>(options.threads);
+        return !failed;
+    }
+
+    // data is copied; Add(id, std::move(vector), ...) hands a buffer over without a copy
+    bool Add(uint64_t id, std::span<const unsigned char> data, std::span<const uint64_t> dependencies = {}, uint64_t timestamp = 0)
+    {
+        return Add(id, std::vector<unsigned char>(data.begin(), data.end()), dependencies, timestamp);
+    }
+
+    bool Add(uint64_t id, std::vector<unsigned char>&& data, std::span<const uint64_t> dependencies = {}, uint64_t timestamp = 0)
+    {
+        if (!pool || failed)
+            return false;
+        auto source = std::make_shared<const std::vector<unsigned char>>(std::move(data));
+
+        entries.emplace_back();
+        RedArchiveEntry& e = entries.back();
+        memset(&e, 0, sizeof(e));
+        e.id = id;
+        e.timestamp = timestamp;
+        e.segmentsStart = uint32_t(segments.size());
+        e.resourceDependenciesStart = uint32_t(this->dependencies.size());
+        this->dependencies.insert(this->dependencies.end(), dependencies.begin(), dependencies.end());
+        e.resourceDependenciesEnd = uint32_t(this->dependencies.size());
+
+        // even an empty file has one segment
+        const uint64_t size = source->size();
+        for (uint64_t pos = 0; pos < size || pos == 0; pos += options.segmentSize)
+        {
+            uint32_t len = uint32_t((std::min)(uint64_t(options.segmentSize), size - pos));
+            WaitForRoom(len);
+            auto job = std::make_shared<Job>();
+            job->source = source;
+            job->data = source->data() + pos;
+            job->size = len;
+            job->segment = uint32_t(segments.size());
+            segments.push_back({ 0, len, len });
+            {
+                std::lock_guard<std::mutex> l(lock);
+                queue.push_back(job);
+                in_flight += len;
+            }
+            pool->Submit([this, job] { Compress(*job); });
+            if (len == 0)
+                break;
+        }
+        e.segmentsEnd = uint32_t(segments.size());
+        e.numInlineBufferSegments = e.segmentsEnd - e.segmentsStart - 1;
+        if (options.hashes)
+            pool->Submit([source, hash = e.hash] { Sha1::Hash(source->data(), source->size(), hash); });
+        WriteDone(false);
+        return !failed;
+    }
+
+    // Write what is still queued, the index and the header. Returns false if any write
+    // failed; the file is then incomplete.
+    bool Finish()
+    {
+        if (!pool)
+            return !failed;
+        WriteDone(true);
+        pool->Wait();   // hashes
+        pool.reset();
+
+        uint64_t index_position = position;
+        RedArchiveIndex index;
+        RedArchiveFileTable table;
+        index.fileTableOffset = sizeof(RedArchiveIndex);
+        index.fileTableSize = uint32_t(sizeof(table) + entries.size() * sizeof(RedArchiveEntry)
+            + segments.size() * sizeof(RedArchiveSegment) + dependencies.size() * sizeof(uint64_t));
+        table.crc64 = 0;
+        table.fileEntryCount = uint32_t(entries.size());
+        table.fileSegmentCount = uint32_t(segments.size());
+        table.resourceDependencyCount = uint32_t(dependencies.size());
+
+        std::vector<unsigned char> tables;
+        Append(tables, &index, sizeof(index));
+        Append(tables, &table, sizeof(table));
+        for (auto& e : entries)
+            Append(tables, &e, sizeof(e));
+        Append(tables, segments.data(), segments.size() * sizeof(RedArchiveSegment));
+        Append(tables, dependencies.data(), dependencies.size() * sizeof(uint64_t));
+        if (options.hashes)
+        {
+            uint64_t crc = Crc64Ecma(tables.data() + sizeof(index) + sizeof(table.crc64), index.fileTableSize - sizeof(table.crc64));
+            memcpy(tables.data() + sizeof(index), &crc, sizeof(crc));
+        }
+        Write(tables.data(), tables.size());
+
+        RedArchiveHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = 'RADR';
+        header.version = 12;
+        header.indexPosition = index_position;
+        header.indexSize = uint32_t(tables.size());
+        header.totalFileSize = position;
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        failed |= !out;
+        return !failed;
+    }
+
+    uint32_t EntryCount() const { return uint32_t(entries.size()); }
+    uint64_t BytesIn() const { return bytes_in; }
+    uint64_t BytesOut() const { return position; }
+
+private:
+    struct Job {
+        std::shared_ptr<const std::vector<unsigned char>> source;
+        const unsigned char* data = nullptr;
+        uint32_t size = 0;
+        uint32_t segment = 0;
+        std::vector<unsigned char> packed;  // frame and payload, empty = store as is
+        bool done = false;
+    };
+
+    static void Append(std::vector<unsigned char>& out, const void* data, size_t size)
+    {
+        auto p = reinterpret_cast<const unsigned char*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+
+    void Compress(Job& job)
+    {
+        std::vector<unsigned char> packed;
+        if (job.size > sizeof(RedArchiveCompressed) && options.codec != kStored)
+        {
+            uint32_t magic = 0;
+            uint64_t n = 0;
+            packed.resize(sizeof(RedArchiveCompressed) + Bound(job.size));
+            unsigned char* dst = packed.data() + sizeof(RedArchiveCompressed);
+            uint64_t capacity = packed.size() - sizeof(RedArchiveCompressed);
+            switch (options.codec)
+            {
+            case kLZ4:
+                magic = 'XLZ4';
+                n = uint64_t((std::max)(LZ4_compress_default(reinterpret_cast<const char*>(job.data), reinterpret_cast<char*>(dst), int(job.size), int(capacity)), 0));
+                break;
+            case kZlib:
+            {
+                magic = 'ZLIB';
+                zlib::uLongf len = zlib::uLongf(capacity);
+                if (zlib::compress2(dst, &len, job.data, zlib::uLong(job.size), options.level < 0 ? 6 : options.level) == Z_OK)
+                    n = len;
+                break;
+            }
+            case kKraken:
+                magic = 'KRAK';
+                n = uint64_t((std::max)(OodleHelper::Compress(8, const_cast<unsigned char*>(job.data), job.size, dst, int64_t(capacity),
+                    options.level < 0 ? 4 : options.level), int64_t(0)));
+                break;
+            default:
+                break;
+            }
+            if (n > 0 && n + sizeof(RedArchiveCompressed) < job.size)
+            {
+                RedArchiveCompressed frame{ magic, job.size };
+                memcpy(packed.data(), &frame, sizeof(RedArchiveCompressed));
+                packed.resize(sizeof(RedArchiveCompressed) + n);
+            }
+            else
+                packed.clear();
+        }
+        std::lock_guard<std::mutex> l(lock);
+        job.packed = std::move(packed);
+        job.done = true;
+        job_done.notify_all();
+    }
+
+    // worst case of every codec: LZ4 and zlib bounds, Kraken adds at most 274 bytes per 256 KiB block
+    static uint64_t Bound(uint32_t size)
+    {
+        uint64_t lz4 = uint64_t(LZ4_compressBound(int(size)));
+        uint64_t zlib = uint64_t(zlib::compressBound(zlib::uLong(size)));
+        uint64_t kraken = uint64_t(size) + 274 * ((uint64_t(size) + 0x3FFFF) / 0x40000);
+        return (std::max)({ lz4, zlib, kraken });
+    }
+
+    void WaitForRoom(uint32_t size)
+    {
+        std::unique_lock<std::mutex> l(lock);
+        // a segment larger than the whole allowance goes alone
+        while (!queue.empty() && in_flight + size > options.maxInFlight)
+        {
+            job_done.wait(l, [this] { return queue.front()->done; });
+            l.unlock();
+            WriteDone(false);
+            l.lock();
+        }
+    }
+
+    // write finished segments from the front of the queue, all of them if wait_all
+    void WriteDone(bool wait_all)
+    {
+        for (;;)
+        {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> l(lock);
+                if (queue.empty())
+                    return;
+                if (wait_all)
+                    job_done.wait(l, [this] { return queue.front()->done; });
+                else if (!queue.front()->done)
+                    return;
+                job = queue.front();
+                queue.pop_front();
+                in_flight -= job->size;
+            }
+            RedArchiveSegment& seg = segments[job->segment];
+            seg.position = position;
+            bytes_in += job->size;
+            if (job->packed.empty())
+                Write(job->data, job->size);
+            else
+            {
+                seg.sizeOnDisk = uint32_t(job->packed.size());
+                Write(job->packed.data(), job->packed.size());
+            }
+        }
+    }
+
+    void Write(const void* data, size_t size)
+    {
+        out.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+        position += size;
+        failed |= !out;
+    }
+
+    Options options;
+    std::ofstream out;
+    uint64_t position = 0;
+    uint64_t bytes_in = 0;
+    bool failed = false;
+    std::unique_ptr<ThreadPool> pool;
+
+    std::deque<RedArchiveEntry> entries;    // stable, hash tasks write into them
+    std::vector<RedArchiveSegment> segments;
+    std::vector<uint64_t> dependencies;
+
+    std::mutex lock;
+    std::condition_variable job_done;
+    std::deque<std::shared_ptr<Job>> queue;     // in file order
+    uint64_t in_flight = 0;
+};
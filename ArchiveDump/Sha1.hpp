@@ -0,0 +1,386 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <span>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ARCHIVEDUMP_X64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ARCHIVEDUMP_TARGET(x)
+#else
+#include <cpuid.h>
+#define ARCHIVEDUMP_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+// --------------------
+// SHA-1 with three backends picked once at runtime:
+//   sha-ni   one stream with the SHA extensions, used whenever the CPU has them
+//   sse2 x4  four independent messages in the four 32-bit lanes of SSE2 registers
+//   scalar   everything else
+// HashMany is the entry point for many messages; with sha-ni it simply hashes them in turn.
+class Sha1 {
+public:
+    typedef uint8_t Digest[20];
+
+    static const char* Backend()
+    {
+        switch (Select())
+        {
+        case Impl::ShaNi: return "sha-ni";
+        case Impl::Sse2x4: return "sse2 x4";
+        default: return "scalar";
+        }
+    }
+
+    static void Hash(const unsigned char* data, uint64_t size, Digest out)
+    {
+        auto compress = Select() == Impl::ShaNi ? CompressShaNiFn() : CompressScalar;
+        uint32_t state[5];
+        Init(state);
+        compress(state, data, size / 64);
+        Finish(state, data + (size & ~uint64_t(63)), size & 63, size, out, compress);
+    }
+
+    // incremental hashing, for data that arrives in pieces
+    class Stream;
+
+    static void HashMany(std::span<const std::span<const unsigned char>> messages, Digest* out)
+    {
+#ifdef ARCHIVEDUMP_X64
+        if (Select() == Impl::Sse2x4)
+        {
+            HashManySse2(messages, out);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < messages.size(); i++)
+            Hash(messages[i].data(), messages[i].size(), out[i]);
+    }
+
+private:
+    typedef void (*Fn_Compress)(uint32_t state[5], const unsigned char* data, uint64_t blocks);
+
+    enum class Impl { Scalar, Sse2x4, ShaNi };
+
+    static Impl Select()
+    {
+        static const Impl impl = Detect();
+        return impl;
+    }
+
+    static Impl Detect()
+    {
+#ifdef ARCHIVEDUMP_X64
+        uint32_t ebx7 = 0, ecx1 = 0;
+#ifdef _MSC_VER
+        int r[4];
+        __cpuid(r, 0);
+        int max_leaf = r[0];
+        __cpuid(r, 1);
+        ecx1 = uint32_t(r[2]);
+        if (max_leaf >= 7)
+        {
+            __cpuidex(r, 7, 0);
+            ebx7 = uint32_t(r[1]);
+        }
+#else
+        unsigned int a, b, c, d;
+        if (__get_cpuid(1, &a, &b, &c, &d))
+            ecx1 = c;
+        if (__get_cpuid_count(7, 0, &a, &b, &c, &d))
+            ebx7 = b;
+#endif
+        const bool ssse3 = ecx1 & (1u << 9);
+        const bool sse41 = ecx1 & (1u << 19);
+        const bool sha = ebx7 & (1u << 29);
+        if (sha && ssse3 && sse41)
+            return Impl::ShaNi;
+        return Impl::Sse2x4;
+#else
+        return Impl::Scalar;
+#endif
+    }
+
+    static void Init(uint32_t state[5])
+    {
+        state[0] = 0x67452301;
+        state[1] = 0xEFCDAB89;
+        state[2] = 0x98BADCFE;
+        state[3] = 0x10325476;
+        state[4] = 0xC3D2E1F0;
+    }
+
+    static uint32_t Rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+    static uint32_t LoadBE(const unsigned char* p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    // pad the last partial block and write the big endian digest
+    static void Finish(uint32_t state[5], const unsigned char* tail, uint64_t tail_len, uint64_t total_len, Digest out, Fn_Compress compress)
+    {
+        unsigned char block[128] = {};
+        memcpy(block, tail, size_t(tail_len));
+        block[tail_len] = 0x80;
+        uint64_t blocks = tail_len + 9 <= 64 ? 1 : 2;
+        uint64_t bits = total_len * 8;
+        for (int i = 0; i < 8; i++)
+            block[blocks * 64 - 1 - i] = uint8_t(bits >> (i * 8));
+        compress(state, block, blocks);
+        for (int i = 0; i < 5; i++)
+        {
+            out[i * 4 + 0] = uint8_t(state[i] >> 24);
+            out[i * 4 + 1] = uint8_t(state[i] >> 16);
+            out[i * 4 + 2] = uint8_t(state[i] >> 8);
+            out[i * 4 + 3] = uint8_t(state[i]);
+        }
+    }
+
+    static void CompressScalar(uint32_t state[5], const unsigned char* data, uint64_t blocks)
+    {
+        for (; blocks > 0; blocks--, data += 64)
+        {
+            uint32_t w[16];
+            for (int t = 0; t < 16; t++)
+                w[t] = LoadBE(data + t * 4);
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+            for (int t = 0; t < 80; t++)
+            {
+                if (t >= 16)
+                    w[t & 15] = Rotl(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1);
+                uint32_t f, k;
+                if (t < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+                else if (t < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                else if (t < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                uint32_t temp = Rotl(a, 5) + f + e + k + w[t & 15];
+                e = d;
+                d = c;
+                c = Rotl(b, 30);
+                b = a;
+                a = temp;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+        }
+    }
+
+#ifdef ARCHIVEDUMP_X64
+    static Fn_Compress CompressShaNiFn() { return CompressShaNi; }
+
+    // four rounds G of 20, with the message schedule interleaved the way the SHA extensions
+    // are meant to be used: msg1 / xor / msg2 run 3, 2 and 1 groups ahead of their use
+    template<int G>
+    ARCHIVEDUMP_TARGET("sha,ssse3,sse4.1")
+    static inline void ShaNiGroup(__m128i& abcd, __m128i& e0, __m128i& e1, __m128i* m)
+    {
+        constexpr int F = G / 5;
+        if constexpr (G == 0)
+        {
+            e0 = _mm_add_epi32(e0, m[0]);
+            e1 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e0, F);
+        }
+        else if constexpr (G % 2 == 0)
+        {
+            e0 = _mm_sha1nexte_epu32(e0, m[G % 4]);
+            e1 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e0, F);
+        }
+        else
+        {
+            e1 = _mm_sha1nexte_epu32(e1, m[G % 4]);
+            e0 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e1, F);
+        }
+        if constexpr (G >= 3 && G <= 18)
+            m[(G + 1) % 4] = _mm_sha1msg2_epu32(m[(G + 1) % 4], m[G % 4]);
+        if constexpr (G >= 1 && G <= 16)
+            m[(G + 3) % 4] = _mm_sha1msg1_epu32(m[(G + 3) % 4], m[G % 4]);
+        if constexpr (G >= 2 && G <= 17)
+            m[(G + 2) % 4] = _mm_xor_si128(m[(G + 2) % 4], m[G % 4]);
+    }
+
+    template<int... G>
+    ARCHIVEDUMP_TARGET("sha,ssse3,sse4.1")
+    static inline void ShaNiRounds(__m128i& abcd, __m128i& e0, __m128i& e1, __m128i* m, std::integer_sequence<int, G...>)
+    {
+        (ShaNiGroup<G>(abcd, e0, e1, m), ...);
+    }
+
+    ARCHIVEDUMP_TARGET("sha,ssse3,sse4.1")
+    static void CompressShaNi(uint32_t state[5], const unsigned char* data, uint64_t blocks)
+    {
+        const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+        __m128i e0 = _mm_set_epi32(int(state[4]), 0, 0, 0);
+        for (; blocks > 0; blocks--, data += 64)
+        {
+            __m128i abcd_save = abcd;
+            __m128i e0_save = e0;
+            __m128i e1;
+            __m128i m[4];
+            for (int i = 0; i < 4; i++)
+                m[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)), mask);
+            ShaNiRounds(abcd, e0, e1, m, std::make_integer_sequence<int, 20>());
+            e0 = _mm_sha1nexte_epu32(e0, e0_save);
+            abcd = _mm_add_epi32(abcd, abcd_save);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = uint32_t(_mm_extract_epi32(e0, 3));
+    }
+
+    static __m128i Rotl4(__m128i x, int n) { return _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - n)); }
+
+    // one 64 byte block for each of four lanes, state is [word][lane]
+    static void CompressSse2x4(uint32_t state[5][4], const unsigned char* const data[4])
+    {
+        __m128i w[16];
+        for (int t = 0; t < 16; t++)
+            w[t] = _mm_set_epi32(int(LoadBE(data[3] + t * 4)), int(LoadBE(data[2] + t * 4)), int(LoadBE(data[1] + t * 4)), int(LoadBE(data[0] + t * 4)));
+        __m128i s[5];
+        for (int i = 0; i < 5; i++)
+            s[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state[i]));
+        __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+        for (int t = 0; t < 80; t++)
+        {
+            if (t >= 16)
+                w[t & 15] = Rotl4(_mm_xor_si128(_mm_xor_si128(w[(t - 3) & 15], w[(t - 8) & 15]), _mm_xor_si128(w[(t - 14) & 15], w[t & 15])), 1);
+            __m128i f, k;
+            if (t < 20) { f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d)); k = _mm_set1_epi32(0x5A827999); }
+            else if (t < 40) { f = _mm_xor_si128(_mm_xor_si128(b, c), d); k = _mm_set1_epi32(0x6ED9EBA1); }
+            else if (t < 60) { f = _mm_or_si128(_mm_and_si128(b, c), _mm_and_si128(d, _mm_or_si128(b, c))); k = _mm_set1_epi32(int(0x8F1BBCDC)); }
+            else { f = _mm_xor_si128(_mm_xor_si128(b, c), d); k = _mm_set1_epi32(int(0xCA62C1D6)); }
+            __m128i temp = _mm_add_epi32(_mm_add_epi32(Rotl4(a, 5), f), _mm_add_epi32(_mm_add_epi32(e, k), w[t & 15]));
+            e = d;
+            d = c;
+            c = Rotl4(b, 30);
+            b = a;
+            a = temp;
+        }
+        s[0] = _mm_add_epi32(s[0], a);
+        s[1] = _mm_add_epi32(s[1], b);
+        s[2] = _mm_add_epi32(s[2], c);
+        s[3] = _mm_add_epi32(s[3], d);
+        s[4] = _mm_add_epi32(s[4], e);
+        for (int i = 0; i < 5; i++)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state[i]), s[i]);
+    }
+
+    // Every lane walks the full blocks of one message; a lane that runs out pads its tail
+    // with the scalar code and picks up the next message, so lanes stay busy when message
+    // sizes differ.
+    static void HashManySse2(std::span<const std::span<const unsigned char>> messages, Digest* out)
+    {
+        static const unsigned char idle_block[64] = {};
+        struct Lane {
+            size_t message = SIZE_MAX;
+            uint64_t offset = 0;
+            uint64_t full = 0;
+        } lanes[4];
+        uint32_t state[5][4] = {};
+        size_t next = 0;
+
+        auto refill = [&](int l) {
+            lanes[l].message = SIZE_MAX;
+            while (next < messages.size())
+            {
+                size_t i = next++;
+                auto msg = messages[i];
+                uint64_t full = msg.size() & ~uint64_t(63);
+                if (full == 0)
+                {
+                    // nothing for the lanes to do
+                    uint32_t st[5];
+                    Init(st);
+                    Finish(st, msg.data(), msg.size(), msg.size(), out[i], CompressScalar);
+                    continue;
+                }
+                uint32_t st[5];
+                Init(st);
+                for (int w = 0; w < 5; w++)
+                    state[w][l] = st[w];
+                lanes[l] = { i, 0, full };
+                return;
+            }
+        };
+
+        for (int l = 0; l < 4; l++)
+            refill(l);
+        for (;;)
+        {
+            const unsigned char* data[4];
+            bool any = false;
+            for (int l = 0; l < 4; l++)
+            {
+                any |= lanes[l].message != SIZE_MAX;
+                data[l] = lanes[l].message != SIZE_MAX ? messages[lanes[l].message].data() + lanes[l].offset : idle_block;
+            }
+            if (!any)
+                break;
+            CompressSse2x4(state, data);
+            for (int l = 0; l < 4; l++)
+            {
+                Lane& lane = lanes[l];
+                if (lane.message == SIZE_MAX)
+                    continue;
+                lane.offset += 64;
+                if (lane.offset < lane.full)
+                    continue;
+                auto msg = messages[lane.message];
+                uint32_t st[5];
+                for (int w = 0; w < 5; w++)
+                    st[w] = state[w][l];
+                Finish(st, msg.data() + lane.full, msg.size() - lane.full, msg.size(), out[lane.message], CompressScalar);
+                refill(l);
+            }
+        }
+    }
+#else
+    static Fn_Compress CompressShaNiFn() { return CompressScalar; }
+#endif
+};
+
+class Sha1::Stream {
+public:
+    Stream() : compress(Select() == Impl::ShaNi ? CompressShaNiFn() : CompressScalar) { Init(state); }
+
+    void Update(const unsigned char* data, uint64_t size)
+    {
+        total += size;
+        if (buffered)
+        {
+            uint64_t take = (std::min)(size, uint64_t(64 - buffered));
+            memcpy(buffer + buffered, data, size_t(take));
+            buffered += take;
+            data += take;
+            size -= take;
+            if (buffered < 64)
+                return;
+            compress(state, buffer, 1);
+            buffered = 0;
+        }
+        compress(state, data, size / 64);
+        buffered = size & 63;
+        memcpy(buffer, data + (size & ~uint64_t(63)), size_t(buffered));
+    }
+
+    void Final(Digest out) { Finish(state, buffer, buffered, total, out, compress); }
+
+private:
+    uint32_t state[5];
+    unsigned char buffer[64];
+    uint64_t buffered = 0;
+    uint64_t total = 0;
+    Fn_Compress compress;
+};
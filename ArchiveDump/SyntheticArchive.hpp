@@ -0,0 +1,347 @@
+#pragma once
+
+#include "RADR.hpp"
+#include "CR2W.hpp"
+#include "Sha1.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+// --------------------
+// Generates RADR archives that read like game archives: header, file table with entries,
+// segments and dependencies, segment data stored or framed as XLZ4 / ZLIB, and optionally
+// CR2W payloads with valid tables, export chunks and (partly compressed) buffers. The same
+// options always give the same bytes. Meant for benchmarks and for trying changes without
+// game files; KRAK is not produced since Oodle cannot be assumed.
+struct SyntheticArchiveOptions {
+    uint32_t entries = 1000;
+    uint64_t minSize = 512;             // entry sizes are log-uniform in [minSize, maxSize]
+    uint64_t maxSize = 256 << 10;
+    uint32_t segmentSize = 64 << 10;    // entries are cut into segments of at most this size
+    uint32_t storedWeight = 1;          // codec mix, drawn per segment
+    uint32_t lz4Weight = 2;
+    uint32_t zlibWeight = 1;
+    double compressibility = 0.75;      // share of payload blocks drawn from a small phrase table
+    double cr2wShare = 0.25;            // share of entries that are CR2W files
+    uint32_t maxDependencies = 4;       // per entry, ids of other entries of the archive
+    bool hashes = true;                 // entry SHA-1 and file table crc64
+    uint64_t seed = 1;
+};
+
+class SyntheticArchive {
+public:
+    static constexpr uint32_t kDataStart = 0x1000;
+
+    // whole archive in memory, ids receives the entry ids in file table order if not null
+    static std::vector<unsigned char> Build(const SyntheticArchiveOptions& opt, std::vector<uint64_t>* ids = nullptr)
+    {
+        std::mt19937_64 rng(opt.seed);
+        Phrases phrases(rng);
+
+        std::vector<unsigned char> out(kDataStart, 0);
+        std::vector<RedArchiveEntry> entries(opt.entries);
+        std::vector<RedArchiveSegment> segments;
+        std::vector<uint64_t> dependencies;
+        std::vector<unsigned char> payload;
+
+        for (auto& e : entries)
+            e.id = rng();
+        for (uint32_t n = 0; n < opt.entries; n++)
+        {
+            auto& e = entries[n];
+            uint64_t size = LogUniform(rng, opt.minSize, opt.maxSize);
+            if (std::uniform_real_distribution<double>(0, 1)(rng) < opt.cr2wShare)
+                payload = SyntheticCR2W(rng, phrases, size, opt.compressibility);
+            else
+                Fill(payload, size, rng, phrases, opt.compressibility);
+
+            e.timestamp = 132000000000000000ull + n;
+            e.segmentsStart = uint32_t(segments.size());
+            for (uint64_t pos = 0; pos < payload.size() || pos == 0; pos += opt.segmentSize)
+            {
+                uint64_t len = (std::min)(uint64_t(opt.segmentSize), payload.size() - pos);
+                RedArchiveSegment seg;
+                seg.position = out.size();
+                seg.sizeInMemory = uint32_t(len);
+                seg.sizeOnDisk = uint32_t(AppendSegment(out, PickCodec(rng, opt), payload.data() + pos, len));
+                segments.push_back(seg);
+                if (len == 0)
+                    break;
+            }
+            e.segmentsEnd = uint32_t(segments.size());
+            e.numInlineBufferSegments = e.segmentsEnd - e.segmentsStart - 1;
+
+            e.resourceDependenciesStart = uint32_t(dependencies.size());
+            uint32_t deps = opt.maxDependencies && opt.entries > 1 ? uint32_t(rng() % (opt.maxDependencies + 1)) : 0;
+            for (uint32_t d = 0; d < deps; d++)
+                dependencies.push_back(entries[rng() % opt.entries].id);
+            e.resourceDependenciesEnd = uint32_t(dependencies.size());
+
+            if (opt.hashes)
+                Sha1::Hash(payload.data(), payload.size(), e.hash);
+            else
+                memset(e.hash, 0, sizeof(e.hash));
+        }
+
+        // index: RedArchiveIndex, then the file table right behind it
+        uint64_t index_position = out.size();
+        RedArchiveIndex index;
+        RedArchiveFileTable table;
+        index.fileTableOffset = sizeof(RedArchiveIndex);
+        index.fileTableSize = uint32_t(sizeof(table) + entries.size() * sizeof(RedArchiveEntry)
+            + segments.size() * sizeof(RedArchiveSegment) + dependencies.size() * sizeof(uint64_t));
+        table.crc64 = 0;
+        table.fileEntryCount = uint32_t(entries.size());
+        table.fileSegmentCount = uint32_t(segments.size());
+        table.resourceDependencyCount = uint32_t(dependencies.size());
+        Append(out, &index, sizeof(index));
+        uint64_t table_position = out.size();
+        Append(out, &table, sizeof(table));
+        Append(out, entries.data(), entries.size() * sizeof(RedArchiveEntry));
+        Append(out, segments.data(), segments.size() * sizeof(RedArchiveSegment));
+        Append(out, dependencies.data(), dependencies.size() * sizeof(uint64_t));
+        if (opt.hashes)
+        {
+            uint64_t crc = Crc64Ecma(out.data() + table_position + sizeof(table.crc64), index.fileTableSize - sizeof(table.crc64));
+            memcpy(out.data() + table_position, &crc, sizeof(crc));
+        }
+
+        RedArchiveHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = 'RADR';
+        header.version = 12;
+        header.indexPosition = index_position;
+        header.indexSize = uint32_t(out.size() - index_position);
+        header.totalFileSize = out.size();
+        memcpy(out.data(), &header, sizeof(header));
+
+        if (ids)
+        {
+            ids->clear();
+            for (auto& e : entries)
+                ids->push_back(e.id);
+        }
+        return out;
+    }
+
+    static bool Write(const std::filesystem::path& file, const SyntheticArchiveOptions& opt, std::vector<uint64_t>* ids = nullptr)
+    {
+        auto bytes = Build(opt, ids);
+        std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+        ofs.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+        return bool(ofs);
+    }
+
+private:
+    enum Codec { kStored, kLZ4, kZlib };
+
+    // a few hundred short words; blocks made of them compress like text and tables do
+    struct Phrases {
+        std::vector<std::string> words;
+        explicit Phrases(std::mt19937_64& rng)
+        {
+            static const char letters[] = "abcdefghijklmnopqrstuvwxyz_";
+            for (int w = 0; w < 256; w++)
+            {
+                std::string word;
+                size_t len = 3 + rng() % 10;
+                for (size_t k = 0; k < len; k++)
+                    word += letters[rng() % (sizeof(letters) - 1)];
+                words.push_back(word + ' ');
+            }
+        }
+    };
+
+    static uint64_t LogUniform(std::mt19937_64& rng, uint64_t lo, uint64_t hi)
+    {
+        if (hi <= lo)
+            return lo;
+        double x = std::uniform_real_distribution<double>(std::log(double(lo)), std::log(double(hi)))(rng);
+        return (std::min)(hi, (std::max)(lo, uint64_t(std::exp(x))));
+    }
+
+    // 256 byte blocks, each either phrases or random bytes
+    static void Fill(std::vector<unsigned char>& out, uint64_t size, std::mt19937_64& rng, const Phrases& phrases, double compressibility)
+    {
+        out.resize(size);
+        std::uniform_real_distribution<double> coin(0, 1);
+        for (uint64_t pos = 0; pos < size; pos += 256)
+        {
+            uint64_t end = (std::min)(size, pos + 256);
+            if (coin(rng) < compressibility)
+            {
+                for (uint64_t k = pos; k < end;)
+                {
+                    auto& w = phrases.words[rng() % phrases.words.size()];
+                    uint64_t n = (std::min)(uint64_t(w.size()), end - k);
+                    memcpy(&out[k], w.data(), n);
+                    k += n;
+                }
+            }
+            else
+            {
+                for (uint64_t k = pos; k < end; k++)
+                    out[k] = uint8_t(rng());
+            }
+        }
+    }
+
+    static Codec PickCodec(std::mt19937_64& rng, const SyntheticArchiveOptions& opt)
+    {
+        uint32_t total = opt.storedWeight + opt.lz4Weight + opt.zlibWeight;
+        uint32_t r = total ? uint32_t(rng() % total) : 0;
+        if (r < opt.storedWeight || total == 0)
+            return kStored;
+        return r < opt.storedWeight + opt.lz4Weight ? kLZ4 : kZlib;
+    }
+
+    static void Append(std::vector<unsigned char>& out, const void* data, size_t size)
+    {
+        auto p = reinterpret_cast<const unsigned char*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+
+    // Append data framed as RedArchiveCompressed, or stored when compressing does not pay off
+    // (a segment is compressed exactly when its disk and memory sizes differ). Returns the
+    // bytes appended.
+    static uint64_t AppendSegment(std::vector<unsigned char>& out, Codec codec, const unsigned char* data, uint64_t size)
+    {
+        std::vector<unsigned char> packed;
+        if (codec != kStored && size > 0 && Compress(codec, data, size, packed)
+            && packed.size() + sizeof(RedArchiveCompressed) < size)
+        {
+            RedArchiveCompressed frame{ codec == kLZ4 ? uint32_t('XLZ4') : uint32_t('ZLIB'), uint32_t(size) };
+            Append(out, &frame, sizeof(frame));
+            Append(out, packed.data(), packed.size());
+            return sizeof(frame) + packed.size();
+        }
+        Append(out, data, size_t(size));
+        return size;
+    }
+
+    static bool Compress(Codec codec, const unsigned char* data, uint64_t size, std::vector<unsigned char>& packed)
+    {
+        if (codec == kLZ4)
+        {
+            packed.resize(size_t(LZ4_compressBound(int(size))));
+            int n = LZ4_compress_default(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(packed.data()), int(size), int(packed.size()));
+            packed.resize(size_t((std::max)(n, 0)));
+            return n > 0;
+        }
+        zlib::uLongf n = zlib::compressBound(zlib::uLong(size));
+        packed.resize(size_t(n));
+        if (zlib::compress2(packed.data(), &n, data, zlib::uLong(size), 6) != Z_OK)
+            return false;
+        packed.resize(size_t(n));
+        return true;
+    }
+
+    // A CR2W file of roughly size bytes: class names and import paths in the string table,
+    // an export tree whose chunks hold about half the bytes, and up to four buffers holding
+    // the rest, every other one compressed. All crc32 fields are filled in.
+    static std::vector<unsigned char> SyntheticCR2W(std::mt19937_64& rng, const Phrases& phrases, uint64_t size, double compressibility)
+    {
+        static const char* classes[] = { "CMesh", "CMaterialInstance", "entEntityTemplate", "physicsColliderMesh", "CBitmapTexture" };
+        const uint32_t class_count = uint32_t(sizeof(classes) / sizeof(classes[0]));
+
+        std::string strings(1, '\0');
+        std::vector<CR2WName> names;
+        for (auto c : classes)
+        {
+            names.push_back({ uint32_t(strings.size()), uint32_t(rng()) });
+            strings += c;
+            strings += '\0';
+        }
+        std::vector<CR2WImport> imports(rng() % 4);
+        for (auto& imp : imports)
+        {
+            imp = { uint32_t(strings.size()), uint16_t(rng() % class_count), 1 };
+            strings += "base\\synthetic\\res_" + std::to_string(rng() % 100000) + ".mesh";
+            strings += '\0';
+        }
+
+        std::vector<CR2WExport> exports(1 + rng() % 8);
+        std::vector<CR2WBuffer> buffers(rng() % 5);
+        uint64_t per_export = (std::max)(uint64_t(16), size / 2 / exports.size());
+        uint64_t per_buffer = buffers.empty() ? 0 : (std::max)(uint64_t(16), size / 2 / buffers.size());
+
+        // header | strings | names | imports | exports | buffers | export data | buffer data
+        uint32_t pos = sizeof(CR2W);
+        CR2W head;
+        memset(&head, 0, sizeof(head));
+        auto place = [&](int t, uint32_t count, uint32_t bytes) {
+            if (!count)
+                return;
+            head.tables[t].pos = pos;
+            head.tables[t].count = count;
+            pos += bytes;
+        };
+        place(0, uint32_t(strings.size()), uint32_t(strings.size()));
+        place(1, uint32_t(names.size()), uint32_t(names.size() * sizeof(CR2WName)));
+        place(2, uint32_t(imports.size()), uint32_t(imports.size() * sizeof(CR2WImport)));
+        place(4, uint32_t(exports.size()), uint32_t(exports.size() * sizeof(CR2WExport)));
+        place(5, uint32_t(buffers.size()), uint32_t(buffers.size() * sizeof(CR2WBuffer)));
+
+        std::vector<unsigned char> data;
+        std::vector<unsigned char> chunk;
+        for (size_t k = 0; k < exports.size(); k++)
+        {
+            Fill(chunk, per_export, rng, phrases, compressibility);
+            auto& ex = exports[k];
+            ex.className = uint16_t(rng() % class_count);
+            ex.objectFlags = 0x2000;
+            ex.parentID = k == 0 ? 0 : uint32_t(1 + rng() % k);
+            ex.dataOffset = pos + uint32_t(data.size());
+            ex.dataSize = uint32_t(chunk.size());
+            ex.tpl = 0;
+            ex.crc32 = Crc32::Compute(chunk.data(), chunk.size());
+            data.insert(data.end(), chunk.begin(), chunk.end());
+        }
+        uint32_t file_size = pos + uint32_t(data.size());
+        for (size_t k = 0; k < buffers.size(); k++)
+        {
+            Fill(chunk, per_buffer, rng, phrases, compressibility);
+            auto& buf = buffers[k];
+            buf.flags = 0;
+            buf.index = uint32_t(k + 1);
+            buf.offset = pos + uint32_t(data.size());
+            buf.memSize = uint32_t(chunk.size());
+            buf.crc32 = Crc32::Compute(chunk.data(), chunk.size());
+            std::vector<unsigned char> framed;
+            buf.diskSize = uint32_t(AppendSegment(framed, k % 2 ? kZlib : kLZ4, chunk.data(), chunk.size()));
+            data.insert(data.end(), framed.begin(), framed.end());
+        }
+
+        head.header.magic = 'W2RC';
+        head.header.version = 195;
+        head.header.fileSize = file_size;
+        head.header.bufferSize = pos + uint32_t(data.size());
+        head.header.numChunks = uint32_t(exports.size());
+
+        std::vector<unsigned char> out(sizeof(CR2W));
+        Append(out, strings.data(), strings.size());
+        Append(out, names.data(), names.size() * sizeof(CR2WName));
+        Append(out, imports.data(), imports.size() * sizeof(CR2WImport));
+        Append(out, exports.data(), exports.size() * sizeof(CR2WExport));
+        Append(out, buffers.data(), buffers.size() * sizeof(CR2WBuffer));
+        Append(out, data.data(), data.size());
+
+        const uint32_t entry_size[10] = { 1, sizeof(CR2WName), sizeof(CR2WImport), sizeof(CR2WProperty),
+            sizeof(CR2WExport), sizeof(CR2WBuffer), sizeof(CR2WEmbedded), 0, 0, 0 };
+        for (int t = 0; t < 10; t++)
+            if (head.tables[t].count)
+                head.tables[t].crc32 = Crc32::Compute(out.data() + head.tables[t].pos, size_t(head.tables[t].count) * entry_size[t]);
+        head.header.crc32 = 0xDEADBEEF;
+        head.header.crc32 = Crc32::Compute(&head, sizeof(head));
+        memcpy(out.data(), &head, sizeof(head));
+        return out;
+    }
+};
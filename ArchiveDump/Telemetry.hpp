@@ -0,0 +1,218 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --------------------
+// Per stage counters for a run: calls, time, bytes and a log2 histogram of call durations.
+// Every thread records into its own block, so a Scope costs two clock reads and no shared
+// writes; blocks are merged when the report is made, after the workers have been joined or
+// waited for. With tracing on, each Scope also becomes a Chrome trace event
+// (chrome://tracing, Perfetto).
+class Telemetry {
+public:
+    enum Stage { kMap, kRead, kDecode, kCR2W, kWrite, kHash, kStageCount };
+
+    static const char* StageName(Stage s)
+    {
+        static const char* names[kStageCount] = { "map", "read", "decode", "cr2w", "write", "hash" };
+        return names[s];
+    }
+
+    static constexpr int kBuckets = 40;     // bucket b holds durations in [2^b, 2^(b+1)) ns
+
+    struct StageStats {
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+        uint64_t bytes = 0;
+        uint64_t histogram[kBuckets] = {};
+
+        void Add(uint64_t duration_ns, uint64_t byte_count)
+        {
+            calls++;
+            ns += duration_ns;
+            bytes += byte_count;
+            int b = 0;
+            while (b + 1 < kBuckets && (duration_ns >> (b + 1)))
+                b++;
+            histogram[b]++;
+        }
+
+        void Merge(const StageStats& other)
+        {
+            calls += other.calls;
+            ns += other.ns;
+            bytes += other.bytes;
+            for (int b = 0; b < kBuckets; b++)
+                histogram[b] += other.histogram[b];
+        }
+
+        // upper bound of the bucket holding the q-th quantile
+        uint64_t QuantileNs(double q) const
+        {
+            uint64_t target = uint64_t(double(calls) * q);
+            uint64_t seen = 0;
+            for (int b = 0; b < kBuckets; b++)
+            {
+                seen += histogram[b];
+                if (seen > target)
+                    return uint64_t(2) << b;
+            }
+            return 0;
+        }
+    };
+
+    static Telemetry& Instance()
+    {
+        static Telemetry telemetry;
+        return telemetry;
+    }
+
+    // RAII timer for one piece of work, bytes may be filled in once they are known
+    class Scope {
+    public:
+        Scope(Stage stage, uint64_t bytes = 0, uint64_t id = 0) : stage(stage), bytes(bytes), id(id), start(Clock::now()) {}
+        ~Scope() { Telemetry::Instance().Record(stage, start, Clock::now(), bytes, id); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        void SetBytes(uint64_t b) { bytes = b; }
+
+    private:
+        Stage stage;
+        uint64_t bytes;
+        uint64_t id;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void EnableTrace(bool on) { tracing = on; }
+
+    void Record(Stage stage, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end, uint64_t bytes, uint64_t id = 0)
+    {
+        ThreadData& t = Local();
+        uint64_t ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+        t.stats[stage].Add(ns, bytes);
+        if (tracing.load(std::memory_order_relaxed))
+            t.events.push_back({ stage, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch).count()), ns, bytes, id });
+    }
+
+    StageStats Total(Stage stage)
+    {
+        StageStats total;
+        std::lock_guard<std::mutex> l(lock);
+        for (auto& t : threads)
+            total.Merge(t->stats[stage]);
+        return total;
+    }
+
+    // one line per stage that saw work; time is summed over threads
+    void PrintReport()
+    {
+        printf("[Stages] %-7s %10s %12s %10s %10s %10s %10s\n", "stage", "calls", "thread ms", "MiB", "MiB/s", "p50 us", "p99 us");
+        for (int s = 0; s < kStageCount; s++)
+        {
+            auto st = Total(Stage(s));
+            if (!st.calls)
+                continue;
+            double ms = double(st.ns) / 1e6;
+            double mib = double(st.bytes) / 1048576.0;
+            printf("[Stages] %-7s %10llu %12.1f %10.1f %10.1f %10.1f %10.1f\n", StageName(Stage(s)), (unsigned long long)st.calls, ms, mib,
+                ms > 0 ? mib / (ms / 1000.0) : 0.0, double(st.QuantileNs(0.5)) / 1000.0, double(st.QuantileNs(0.99)) / 1000.0);
+        }
+    }
+
+    // the same numbers as PrintReport, histograms included, plus whatever extra holds
+    // (a JSON object body without braces, may be empty)
+    bool WriteReport(const std::filesystem::path& file, const std::string& extra = "")
+    {
+        std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+        ofs << "{\n  \"stages\": {";
+        bool first = true;
+        for (int s = 0; s < kStageCount; s++)
+        {
+            auto st = Total(Stage(s));
+            ofs << (first ? "\n" : ",\n") << "    \"" << StageName(Stage(s)) << "\": { \"calls\": " << st.calls << ", \"ns\": " << st.ns
+                << ", \"bytes\": " << st.bytes << ", \"histogramLog2Ns\": [";
+            for (int b = 0; b < kBuckets; b++)
+                ofs << (b ? "," : "") << st.histogram[b];
+            ofs << "] }";
+            first = false;
+        }
+        ofs << "\n  }";
+        if (!extra.empty())
+            ofs << ",\n  " << extra;
+        ofs << "\n}\n";
+        return bool(ofs);
+    }
+
+    // Chrome trace event format, one complete ("X") event per Scope
+    bool WriteTrace(const std::filesystem::path& file)
+    {
+        std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+        ofs << "{\"traceEvents\":[\n";
+        bool first = true;
+        char line[256];
+        std::lock_guard<std::mutex> l(lock);
+        for (auto& t : threads)
+        {
+            for (auto& e : t->events)
+            {
+                snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"archivedump\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"bytes\":%llu,\"id\":\"%llu\"}}",
+                    first ? "" : ",\n", StageName(e.stage), double(e.start_ns) / 1000.0, double(e.ns) / 1000.0, t->tid,
+                    (unsigned long long)e.bytes, (unsigned long long)e.id);
+                ofs << line;
+                first = false;
+            }
+        }
+        ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return bool(ofs);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct TraceEvent {
+        Stage stage;
+        uint64_t start_ns;
+        uint64_t ns;
+        uint64_t bytes;
+        uint64_t id;
+    };
+
+    struct ThreadData {
+        uint32_t tid = 0;
+        StageStats stats[kStageCount];
+        std::vector<TraceEvent> events;
+    };
+
+    Telemetry() : epoch(Clock::now()) {}
+
+    // blocks outlive their threads so the report still sees them
+    ThreadData& Local()
+    {
+        thread_local ThreadData* local = nullptr;
+        if (!local)
+        {
+            auto data = std::make_unique<ThreadData>();
+            std::lock_guard<std::mutex> l(lock);
+            data->tid = uint32_t(threads.size() + 1);
+            local = data.get();
+            threads.push_back(std::move(data));
+        }
+        return *local;
+    }
+
+    Clock::time_point epoch;
+    std::atomic<bool> tracing = false;
+    std::mutex lock;
+    std::vector<std::unique_ptr<ThreadData>> threads;
+};
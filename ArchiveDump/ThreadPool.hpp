@@ -0,0 +1,222 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------
+// Work-stealing pool.
+// Every worker owns a queue and takes work from its front, so a run of tasks submitted
+// to one queue executes in submission order. Idle workers steal from the back of other
+// queues, which keeps the owner walking its run front-to-back while thieves take the tail.
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t threads = 0)
+    {
+        if (threads == 0)
+            threads = (std::max)(1u, std::thread::hardware_concurrency());
+        for (uint32_t i = 0; i < threads; i++)
+            queues.emplace_back(std::make_unique<WorkQueue>());
+        for (uint32_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { WorkerLoop(i); });
+    }
+
+    ~ThreadPool()
+    {
+        Wait();
+        {
+            std::lock_guard<std::mutex> l(state_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto&& t : workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint32_t Size() const { return uint32_t(workers.size()); }
+
+    void Submit(std::function<void()> task, uint32_t queue_index)
+    {
+        pending++;
+        {
+            auto& q = *queues[queue_index % queues.size()];
+            std::lock_guard<std::mutex> l(q.lock);
+            q.tasks.emplace_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> l(state_lock);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    void Submit(std::function<void()> task)
+    {
+        Submit(std::move(task), next_queue++);
+    }
+
+    // Run fn(0) .. fn(count - 1) on the pool and the calling thread, return when all are done.
+    // The caller claims indices itself and only waits for ones already running elsewhere,
+    // so this is safe to call from inside a pool task.
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& fn)
+    {
+        if (count == 0)
+            return;
+        struct State {
+            std::atomic<uint32_t> next = 0;
+            std::atomic<uint32_t> done = 0;
+            uint32_t count = 0;
+            const std::function<void(uint32_t)>* fn = nullptr;
+            std::mutex lock;
+            std::condition_variable finished;
+        };
+        auto state = std::make_shared<State>();
+        state->count = count;
+        state->fn = &fn;
+        auto run = [](State& st) {
+            for (uint32_t i; (i = st.next++) < st.count;)
+            {
+                (*st.fn)(i);
+                if (++st.done == st.count)
+                {
+                    std::lock_guard<std::mutex> l(st.lock);
+                    st.finished.notify_all();
+                }
+            }
+        };
+        // helpers that start after everything is claimed return right away
+        uint32_t helpers = (std::min)(count - 1, Size());
+        for (uint32_t h = 0; h < helpers; h++)
+            Submit([state, run] { run(*state); });
+        run(*state);
+        std::unique_lock<std::mutex> l(state->lock);
+        state->finished.wait(l, [&] { return state->done == state->count; });
+    }
+
+    // block until every submitted task has finished
+    void Wait()
+    {
+        std::unique_lock<std::mutex> l(state_lock);
+        idle.wait(l, [this] { return pending == 0; });
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool TryPop(uint32_t self, std::function<void()>& task)
+    {
+        {
+            auto& q = *queues[self];
+            std::lock_guard<std::mutex> l(q.lock);
+            if (!q.tasks.empty())
+            {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++)
+        {
+            auto& q = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> l(q.lock);
+            if (!q.tasks.empty())
+            {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(uint32_t self)
+    {
+        std::function<void()> task;
+        for (;;)
+        {
+            if (TryPop(self, task))
+            {
+                task();
+                task = nullptr;
+                if (--pending == 0)
+                {
+                    std::lock_guard<std::mutex> l(state_lock);
+                    idle.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> l(state_lock);
+            wake.wait(l, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<uint64_t> pending = 0;  // submitted, not finished
+    std::atomic<uint64_t> queued = 0;   // submitted, not started
+    std::atomic<uint32_t> next_queue = 0;
+    bool stopping = false;
+};
+
+// --------------------
+// Caps the number of bytes held by in-flight tasks. Acquire blocks until the request fits;
+// a request larger than the whole budget is let through alone so it can never deadlock.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uint64_t limit = 0) : limit(limit) {}
+
+    void Acquire(uint64_t bytes)
+    {
+        if (limit == 0)
+            return;
+        std::unique_lock<std::mutex> l(lock);
+        released.wait(l, [&] { return in_flight == 0 || in_flight + bytes <= limit; });
+        in_flight += bytes;
+    }
+
+    // charge without waiting, for memory that is needed to finish work already admitted
+    void Charge(uint64_t bytes)
+    {
+        if (limit == 0)
+            return;
+        std::lock_guard<std::mutex> l(lock);
+        in_flight += bytes;
+    }
+
+    void Release(uint64_t bytes)
+    {
+        if (limit == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            in_flight -= bytes;
+        }
+        released.notify_all();
+    }
+
+private:
+    uint64_t limit;
+    uint64_t in_flight = 0;
+    std::mutex lock;
+    std::condition_variable released;
+};